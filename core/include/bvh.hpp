@@ -0,0 +1,189 @@
+#pragma once
+#include "constants.hpp"
+#include "geometry.hpp"
+
+#include <array>
+#include <optional>
+#include <vector>
+
+namespace projector {
+
+/// @brief Bounding volume hierarchy over indexed bounding boxes.
+///
+/// Used to speed up object lookups. Point queries return the item with the highest index, to keep
+/// the priority of later defined objects, distance queries return the nearest hit.
+class bvh {
+
+    struct node {
+        bounding_box box;
+        std::size_t max_index; ///< highest item index in the subtree
+        std::size_t right;     ///< index of the right child, the left child follows the node
+        std::size_t first;     ///< first item of a leaf in items
+        std::size_t count;     ///< item count of a leaf, 0 for inner nodes
+    };
+
+    /// Size of the traversal stacks. The median splits keep the depth of the tree at about log2
+    /// of the item count and a depth first traversal keeps at most one node per level plus one on
+    /// the stack, so no hierarchy over a size_t item count needs more.
+    static constexpr std::size_t stack_size = 64;
+
+    std::vector<node> nodes;
+    std::vector<std::size_t> items;
+    std::vector<bounding_box> boxes;
+
+    std::size_t build_node(std::size_t first, std::size_t count);
+
+public:
+    /// Build the hierarchy, replaces the previous one.
+    /// @param item_boxes bounding boxes of the items, indexed by item index
+    void build(const std::vector<bounding_box> &item_boxes);
+
+    /// Bounding box of an item.
+    const bounding_box &box(std::size_t index) const { return boxes[index]; }
+
+    /// Find the item with the highest index whose box contains the point and which passes a test.
+    ///
+    /// @param point the point to evaluate
+    /// @param test the test of an item index, should return true if the point is inside the item
+    /// @return the found item index, empty if none was found
+    template <typename F>
+    std::optional<std::size_t> find_last(const vec3 &point, F test) const;
+
+    /// Find all items whose boxes overlap a box, used to select the items for a packet of points.
+    ///
+    /// @param query the box to overlap
+    /// @param found the overlapping item indices in increasing order, the vector is overwritten
+    void find_overlapping(const bounding_box &query, std::vector<std::size_t> &found) const;
+
+    /// Find the nearest distance to items along a ray. Items whose boxes are further than the
+    /// nearest distance found so far are skipped.
+    ///
+    /// @param point the origin of the ray
+    /// @param dir the direction of the ray, normalized
+    /// @param distance the distance to an item index along the ray
+    /// @return the nearest distance, infinity if nothing is hit
+    template <typename F>
+    double nearest(const vec3 &point, const vec3 &dir, F distance) const;
+};
+
+template <typename F>
+std::optional<std::size_t> bvh::find_last(const vec3 &point, F test) const {
+
+    std::optional<std::size_t> found;
+
+    if (nodes.empty()) {
+        return found;
+    }
+
+    auto contains = [&point](const bounding_box &box) {
+        for (std::size_t i = 0; i < 3; ++i) {
+            if (point[i] < box.min[i] || point[i] > box.max[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // the queries run for each transport step, so the stack is kept off the heap
+    std::array<std::size_t, stack_size> stack;
+    std::size_t stack_top = 0;
+    stack[stack_top++] = 0;
+
+    while (stack_top > 0) {
+        std::size_t current = stack[--stack_top];
+        const node &n = nodes[current];
+
+        // nothing in the subtree can have higher priority than what we already found
+        if (found && n.max_index <= *found) {
+            continue;
+        }
+
+        if (!contains(n.box)) {
+            continue;
+        }
+
+        if (n.count == 0) {
+            // push the child with higher priority last, so it is visited first
+            std::size_t left = current + 1;
+            if (nodes[left].max_index > nodes[n.right].max_index) {
+                stack[stack_top++] = n.right;
+                stack[stack_top++] = left;
+            } else {
+                stack[stack_top++] = left;
+                stack[stack_top++] = n.right;
+            }
+            continue;
+        }
+
+        for (std::size_t i = n.first; i < n.first + n.count; ++i) {
+            std::size_t index = items[i];
+            if ((!found || index > *found) && contains(boxes[index]) && test(index)) {
+                found = index;
+            }
+        }
+    }
+
+    return found;
+}
+
+template <typename F>
+double bvh::nearest(const vec3 &point, const vec3 &dir, F distance) const {
+
+    double nearest_distance = constants::infinity;
+
+    if (nodes.empty()) {
+        return nearest_distance;
+    }
+
+    vec3 inv_dir = dir.cwiseInverse();
+
+    // distance to enter the box, infinity if it is missed
+    auto entry = [&point, &inv_dir](const bounding_box &box) {
+        auto [t_entry, t_exit] = box.slab_intersect(point, inv_dir);
+        if (t_entry > t_exit || t_exit < 0.0) {
+            return constants::infinity;
+        }
+        return std::max(t_entry, 0.0);
+    };
+
+    // the node entry distances and indices
+    std::array<std::pair<double, std::size_t>, stack_size> stack;
+    std::size_t stack_top = 0;
+    stack[stack_top++] = {entry(nodes[0].box), 0};
+
+    while (stack_top > 0) {
+        auto [node_distance, current] = stack[--stack_top];
+
+        if (node_distance >= nearest_distance) {
+            continue;
+        }
+
+        const node &n = nodes[current];
+
+        if (n.count == 0) {
+            // visit the nearer child first
+            double left_distance = entry(nodes[current + 1].box);
+            double right_distance = entry(nodes[n.right].box);
+
+            if (left_distance < right_distance) {
+                stack[stack_top++] = {right_distance, n.right};
+                stack[stack_top++] = {left_distance, current + 1};
+            } else {
+                stack[stack_top++] = {left_distance, current + 1};
+                stack[stack_top++] = {right_distance, n.right};
+            }
+            continue;
+        }
+
+        for (std::size_t i = n.first; i < n.first + n.count; ++i) {
+            std::size_t index = items[i];
+            if (entry(boxes[index]) < nearest_distance) {
+                nearest_distance = std::min(nearest_distance, distance(index));
+            }
+        }
+    }
+
+    return nearest_distance;
+}
+
+} // namespace projector
@@ -0,0 +1,72 @@
+#pragma once
+#include "surface_kernels.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace projector {
+
+/// Instructions of the compiled CSG program
+enum class csg_opcode : uint8_t {
+    push_true,    ///< push true on the stack
+    plane,        ///< push the inside test of plane with given index
+    axis_quadric, ///< push the inside test of axis aligned quadric with given index
+    quadric,      ///< push the inside test of general quadric with given index
+    box,          ///< push the inside test of axis aligned box with given index
+    join,         ///< pop b, a, push a || b
+    intersect,    ///< pop b, a, push a && b
+    substract     ///< pop b, a, push a && !b
+};
+
+struct csg_instruction {
+    csg_opcode code;
+    uint32_t index;
+};
+
+/// @brief Geometry compiled into a flat postfix program.
+///
+/// Surface parameters are stored by value in arrays grouped by the surface type, so the program
+/// is evaluated without pointer chasing or virtual calls. The inside test is evaluated on a stack
+/// of booleans, packed into a single integer.
+struct csg_program {
+
+    /// Max depth of the evaluation stack
+    static constexpr std::size_t max_depth = 64;
+
+    /// Rays of a packet evaluated together, larger packets are split
+    static constexpr std::size_t packet_width = 64;
+
+    std::vector<csg_instruction> code;
+
+    plane_set planes;
+    axis_quadric_set axis_quadrics;
+    quadric_set quadrics;
+    box_set boxes;
+
+    void add_plane(const plane_coeffs &plane);
+
+    void add_axis_quadric(const axis_quadric_coeffs &quadric);
+
+    void add_quadric(const quadric_coeffs &quadric);
+
+    void add_box(const vec3 &min, const vec3 &max);
+
+    void add_operation(csg_opcode op);
+
+    /// Check the program, throws if it is not valid.
+    void validate() const;
+
+    bool empty() const { return code.empty(); }
+
+    bool point_inside(const vec3 &point) const;
+
+    double nearest_surface_distance(const vec3 &point, const vec3 &dir) const;
+
+    /// Inside test of a packet of points, the directions of the packet are not used.
+    void points_inside(const ray_packet &points, uint8_t *inside) const;
+
+    /// Nearest surface distances of a packet of rays.
+    void nearest_surface_distances(const ray_packet &rays, double *distances) const;
+};
+
+} // namespace projector
@@ -1,4 +1,5 @@
 #pragma once
+#include "bvh.hpp"
 #include "geometry.hpp"
 #include "material.hpp"
 #include "particle.hpp"
@@ -21,6 +22,13 @@ struct object {
     geometry geom;
 };
 
+/// Scratch buffers of the packet object lookups, reused for all packets of the caller
+struct object_lookup_scratch {
+    std::vector<std::size_t> candidates; ///< objects whose boxes overlap the packet
+    std::vector<uint8_t> inside;         ///< whether the points are in the object box
+    std::vector<uint8_t> in_geometry;    ///< whether the points are in the object geometry
+};
+
 struct environment {
     std::string name;
     std::string description;
@@ -31,6 +39,30 @@ struct environment {
     std::size_t stack_size;
     bounding_box bounds;
 
+    std::size_t batch_size;            ///< particles per batch, 0 means single batch
+    double target_relative_error;      ///< stop once reached on convergence tallies, 0 to disable
+    double convergence_score_fraction; ///< checked values, fraction of the largest tally score
+    std::vector<std::string> convergence_tally_ids;
+    std::vector<std::size_t> convergence_tallies; ///< indices of convergence tallies
+
+    tally_accumulation accumulation; ///< how the tallies accumulate the scores of the threads
+
+    std::size_t total_particles;   ///< total particle count of all sources
+    std::size_t sourced_particles; ///< particles sourced in all batches so far
+    std::size_t batch_count;       ///< number of finished batches
+    std::size_t batch_start;       ///< global index of the first particle of the current batch
+    std::size_t batch_particles;   ///< particle count of the current batch
+
+    /// Particles transported between the flushes of the tallies, bounds the float sums of the
+    /// mixed precision build regardless of the batch size
+    std::size_t tally_flush_particles = 65536;
+
+    std::size_t xs_cache_hits;   ///< material lookups reused from the particle cache
+    std::size_t xs_cache_misses; ///< material lookups computed
+
+    /// cumulative photon counts of the objects, maps particle index to its source object
+    std::vector<std::size_t> source_offsets;
+
 
     std::filesystem::path material_path;
     std::filesystem::path objects_path;
@@ -45,9 +77,45 @@ struct environment {
 
     std::vector<object> objects;
 
+    bvh object_tree; ///< hierarchy over object bounding boxes, built when objects are loaded
+
+    std::vector<std::unique_ptr<tally_filter>> filters; ///< filters of the tallies, by their slots
+
     std::vector<std::unique_ptr<tally>> tallies;
 
-    std::vector<particle> particles;
+    tally_scorer scorer; ///< fused scoring of the tallies, built when the runtime is initialized
+
+    std::vector<particle> particles; ///< particles of the current batch, if paths are saved
+
+    /// Build the object hierarchy, must be called after the objects are loaded.
+    void build_object_tree();
+
+    /// Find the object containing a point. Objects defined later take priority.
+    /// @param point the point to evaluate
+    /// @return the found object or nullptr if the point is in void
+    const object *find_object(const vec3 &point) const;
+
+    /// Get the index of an object
+    /// @param obj the object, nullptr for void
+    /// @return the index of the object in objects, no_object for void
+    std::size_t object_index(const object *obj) const {
+        return obj == nullptr ? no_object : static_cast<std::size_t>(obj - objects.data());
+    }
+
+    /// Packet version of find_object, the directions of the packet are not used. Only the objects
+    /// whose boxes overlap the bounds of the packet are tested.
+    /// @param points the points to evaluate
+    /// @param found the found objects, nullptr for points in void
+    /// @param scratch buffers of the lookup, reused between the calls
+    void find_objects(const ray_packet &points, const object **found,
+                      object_lookup_scratch &scratch) const;
+
+    /// Calculate distance to the nearest object surface along a line. If no object is hit, returns
+    /// distance to the environment bounds.
+    /// @param point the start point of the line
+    /// @param dir the direction of the line, normalized
+    /// @return distance to the nearest surface
+    double nearest_object_distance(const vec3 &point, const vec3 &dir) const;
 };
 
 } // namespace projector
\ No newline at end of file
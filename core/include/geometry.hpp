@@ -1,5 +1,6 @@
 #pragma once
 
+#include "csg_program.hpp"
 #include "surface.hpp"
 
 #include <Eigen/Dense>
@@ -20,14 +21,19 @@ struct bounding_box {
 
     bool point_inside(const vec3 &point) const;
 
-    bool point_inside_2d(const vec3& point, std::size_t index1, std::size_t index2) const;
-
     bool line_intersects(const vec3& point, const vec3& dir) const;
 
     bool segment_intersect(const vec3& start, const vec3& end) const;
 
     double distance_along_line(const vec3 &point, const vec3 &dir) const;
 
+    /// Slab test of a ray against the box, shared with the box surface and the BVH.
+    ///
+    /// @param point the origin of the ray
+    /// @param inv_dir the inverted direction of the ray (1 / dir per component)
+    /// @return entry and exit distance along the ray, the ray misses the box if entry > exit
+    std::pair<double, double> slab_intersect(const vec3 &point, const vec3 &inv_dir) const;
+
     vec3 random_sample(uint64_t &prng_state) const;
 };
 
@@ -36,6 +42,17 @@ class geometry {
     std::vector<std::variant<geometry, std::unique_ptr<surface>>> surfaces;
     std::vector<csg_operation> ops;
 
+    /// Flat form of the tree above, used for the queries once compiled
+    csg_program program;
+
+    bool is_intersection() const;
+
+    void emit_operand(std::size_t index, csg_program &output) const;
+
+    void emit_intersection_operands(csg_program &output) const;
+
+    void emit(csg_program &output) const;
+
 public:
 
     bounding_box bb;
@@ -48,9 +65,23 @@ public:
 
     bool point_inside(const vec3 &point) const;
 
+    /// Packet version of point_inside, the directions of the packet are not used.
+    void points_inside(const ray_packet &points, uint8_t *inside) const;
+
+    /// Packet version of nearest_surface_distance.
+    void nearest_surface_distances(const ray_packet &rays, double *distances) const;
+
     vec3 sample_point(uint64_t &prng_state) const;
 
     void update_bounding_box(const vec3 &min, const vec3 &max);
+
+    /// Compile the tree into a flat program used by the point and distance queries.
+    ///
+    /// Surfaces with no operation are dropped and nested intersections are merged into
+    /// the parent. Should be called after all surfaces were added.
+    void compile();
+
+    bool compiled() const { return !program.empty(); }
 };
 
 vec3 rotate_direction(vec3 dir, double mu, double phi);
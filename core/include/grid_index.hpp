@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace projector {
+
+/// Method used to find the interval of a tabulated grid containing a value
+enum class grid_search {
+    binary,  ///< binary search over the whole grid
+    log_hash ///< logarithmic hash index narrowing the binary search to a few grid points
+};
+
+/// Search index of a sorted grid of energies or momentum transfers.
+///
+/// The range of the logarithm of the positive grid values is split into equal width bins, every
+/// bin stores the range of grid points it covers. A lookup computes the bin directly from the
+/// logarithm of the value and does the binary search only inside of the range of the bin.
+/// An empty index falls back to the binary search over the whole grid.
+class log_grid_index {
+
+    std::vector<uint32_t> bin_start; ///< upper bound of the lower edge of each bin
+    double log_min = 0.0;
+    double inv_bin_width = 0.0;
+
+public:
+    log_grid_index() = default;
+
+    /// @param grid sorted grid, can start with zero and contain repeated values
+    /// @param bins number of bins, 0 uses one bin per grid point
+    explicit log_grid_index(std::span<const double> grid, std::size_t bins = 0);
+
+    bool empty() const { return bin_start.empty(); }
+
+    /// Find the first grid value greater than x, same result as std::upper_bound.
+    /// @param grid the grid the index was built for
+    std::size_t upper_bound(double x, std::span<const double> grid) const;
+};
+
+} // namespace projector
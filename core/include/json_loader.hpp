@@ -24,6 +24,34 @@ NLOHMANN_JSON_SERIALIZE_ENUM(tally_score,
 
 )
 
+NLOHMANN_JSON_SERIALIZE_ENUM(tally_accumulation,
+                             {
+                                 {tally_accumulation::atomic, "atomic"},
+                                 {tally_accumulation::thread_private, "thread_private"},
+                                 {tally_accumulation::deterministic, "deterministic"}
+                             }
+
+)
+
+NLOHMANN_JSON_SERIALIZE_ENUM(filter_type, {
+                                              {filter_type::energy, "energy"},
+                                              {filter_type::interaction, "interaction"},
+                                              {filter_type::object, "object"},
+                                              {filter_type::material, "material"},
+                                              {filter_type::generation, "generation"},
+                                          })
+
+NLOHMANN_JSON_SERIALIZE_ENUM(cross_section,
+                             {
+                                 {cross_section::no_interaction, "no_interaction"},
+                                 {cross_section::coherent, "coherent"},
+                                 {cross_section::incoherent, "incoherent"},
+                                 {cross_section::photoelectric, "photoelectric"},
+                                 {cross_section::pair_production, "pair_production"}
+                             }
+
+)
+
 std::unique_ptr<surface> parse_surface(nlohmann::json &j);
 
 void parse_geometry(geometry &geom, std::string_view key, nlohmann::json &j);
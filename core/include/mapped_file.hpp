@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+namespace projector {
+
+/// Read-only memory mapping of a whole file, unmapped when destroyed.
+class mapped_file {
+
+    void *address;
+    std::size_t length = 0;
+
+public:
+    explicit mapped_file(const std::filesystem::path &path);
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    ~mapped_file();
+
+    const char *data() const { return static_cast<const char *>(address); }
+
+    std::size_t size() const { return length; }
+
+    std::string_view text() const { return {data(), length}; }
+};
+
+} // namespace projector
@@ -1,8 +1,13 @@
 #pragma once
+#include "grid_index.hpp"
+
 #include <array>
 #include <cstdint>
 #include <filesystem>
+#include <ios>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
 #include <vector>
 
@@ -34,10 +39,65 @@ struct sampled_xs {
     double total;
 };
 
+/// Cross sections of one element at one point of the union energy grid. The channels are
+/// interleaved, so one index loads all of them from one cache line.
+struct alignas(32) xs_point {
+    double coherent;
+    double incoherent;
+    double photoelectric;
+    double pair_production;
+};
+
+/// Tabulated inverse cumulative distribution of the scattering cosine on a logarithmic energy
+/// grid. The cosines are stored at equiprobable quantiles, so sampling needs no search.
+struct angular_table {
+    static constexpr std::size_t quantile_count = 128;
+
+    double log_min = 0.0;  ///< logarithm of the first energy
+    double inv_step = 0.0; ///< inverse of the logarithmic energy step
+    std::size_t energies = 0;
+
+    /// `quantile_count + 1` cosines for each energy, for the cumulative probabilities
+    /// `k / quantile_count`
+    std::vector<double> quantiles;
+
+    bool empty() const { return quantiles.empty(); }
+
+    /// Set up the energy grid, log spaced between the energies.
+    void init(double min_energy, double max_energy, std::size_t points_per_decade);
+
+    /// Get the i-th energy of the grid.
+    double energy(std::size_t index) const;
+
+    /// Get the quantiles of the i-th energy.
+    double *row(std::size_t index) { return quantiles.data() + index * (quantile_count + 1); }
+
+    /// Sample the scattering cosine. The energies between the grid points are interpolated
+    /// statistically - the neighbouring grid point is chosen with probability given by the
+    /// position between them.
+    double sample(double energy, uint64_t &prng_state) const;
+};
+
 class element {
 
-    std::array<std::vector<double>, 5> xs_data;
-    std::array<std::vector<double>, 5> ff_data;
+    friend class data_library;
+
+    // the tables are views of memory owned by the storage, either the parsed data or the mapped
+    // binary cache, copies of the element share it
+    std::shared_ptr<const void> storage;
+    std::array<std::span<const double>, 5> xs_data;
+    std::array<std::span<const double>, 5> ff_data;
+
+    std::vector<xs_point> union_xs; ///< cross sections on the union energy grid
+
+    angular_table rayleigh_table; ///< coherent scattering cosine distribution
+    angular_table compton_table;  ///< incoherent scattering cosine distribution
+
+    // search indices of the energy grid and of the form factor grids
+    log_grid_index xs_index;
+    log_grid_index incoherent_index;
+    log_grid_index coherent_index;
+    log_grid_index cumulative_coherent_index;
 
 public:
     uint32_t atomic_number;
@@ -49,14 +109,60 @@ public:
 
     sampled_xs get_all_cross_sections(double energy) const;
 
+    /// Get cross sections from the union energy grid table.
+    /// @param index the interval of the union grid, from data_library::union_grid_position
+    /// @param t the position in the interval
+    sampled_xs get_all_cross_sections(std::size_t index, double t) const;
+
+    /// The energy grid of the element cross sections.
+    std::span<const double> energy_grid() const { return xs_data[0]; }
+
+    /// The raw cross section tables - the energy grid followed by the cross sections in the order
+    /// of cross_section.
+    std::span<const double> cross_section_table(std::size_t index) const { return xs_data[index]; }
+
+    /// The raw form factor tables - incoherent x and values, coherent x, cumulative and
+    /// differential values.
+    std::span<const double> form_factor_table(std::size_t index) const { return ff_data[index]; }
+
+    /// Tabulate the cross sections on the union energy grid.
+    void build_union_table(const std::vector<double> &union_energy);
+
+    /// Build or drop the search indices of the tabulated data.
+    void set_grid_search(grid_search method);
+
+    /// Whether the tabulated data of the element are loaded.
+    bool loaded() const { return !xs_data[0].empty(); }
+
+    /// Tabulate the distributions of the scattering variables, used by the sampling methods.
+    void build_sampling_tables();
+
+    /// Sample the coherent scattering cosine from the tables, falls back to the rejection
+    /// sampling when they are not built.
     double rayleigh(double energy, uint64_t &prng_state) const;
 
+    /// Sample the coherent scattering cosine by rejection, the reference for the tables.
+    double rayleigh_rejection(double energy, uint64_t &prng_state) const;
+
+    /// Sample the incoherent scattering from the tables, falls back to the rejection sampling
+    /// when they are not built.
+    /// @return the energy after the scattering and the scattering cosine
     std::pair<double, double> compton(double energy, uint64_t &prng_state) const;
 
+    /// Sample the incoherent scattering by rejection, the reference for the tables.
+    /// @return the energy after the scattering and the scattering cosine
+    std::pair<double, double> compton_rejection(double energy, uint64_t &prng_state) const;
+
     // deprecated! use endf
     static element load_xcom_file(std::filesystem::path path);
 
-    static element load_from_ace_file(std::filesystem::path path, std::size_t line);
+    /// Load the element table from an ACE file.
+    /// @param offset byte offset of the first line of the element table in the file
+    static element load_from_ace_file(std::filesystem::path path, std::streamoff offset);
+
+    /// Parse the element table from the ACE text.
+    /// @param text the text starting at the first line of the element table
+    static element load_from_ace_text(std::string_view text);
 };
 
 struct material_data {
@@ -68,26 +174,107 @@ struct material_data {
     std::vector<double> atomic_percentage;
     std::vector<double> weight_percentage;
     std::vector<double> atom_density;
+
+    /// Cumulative macroscopic total cross sections of the elements on the union energy grid,
+    /// `elements.size()` values per grid point, the last one is the material total.
+    std::vector<double> macro_xs_cumulative;
+};
+
+/// Result of sampling the collision element of a material
+struct material_sample {
+    double total_macro_xs; ///< macroscopic total cross section of the material
+    const element *elem;   ///< the sampled element
+    sampled_xs elem_xs;    ///< cross sections of the sampled element
+};
+
+/// Cross sections of a material at the last looked up energy. The photon energy changes only in
+/// Compton events, so the lookup can be reused after surface crossings and Rayleigh scattering.
+struct material_xs_cache {
+    const material_data *material = nullptr; ///< cached material, nullptr when empty
+    double energy = 0.0;                     ///< cached energy
+    std::size_t index = 0;                   ///< interval of the union energy grid
+    double t = 0.0;                          ///< position in the interval
+    std::vector<double> cumulative;          ///< cumulative macroscopic xs of the elements
+
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+
+    void clear() { material = nullptr; }
+};
+
+/// Location of an element table, from the xsdir file
+struct ace_location {
+    std::filesystem::path path; ///< the ACE file
+    std::size_t line;           ///< first line of the element table, starting at 1
 };
 
 class data_library {
 
     std::array<element, 100> elements;
+    std::array<ace_location, 100> locations;
+
+    std::vector<double> union_energy; ///< union of the energy grids of the used elements
+    log_grid_index union_index;
+
+    grid_search search_method = grid_search::binary;
 
 public:
     const element &get_element(std::size_t atomic_number) const;
 
+    /// Select the method used to search the energy and form factor grids of all elements.
+    void set_grid_search(grid_search method);
+
+    /// Load the tables of the elements used by the materials, which are not loaded yet. The
+    /// elements are loaded in parallel.
+    void load_elements(const std::vector<material_data> &materials);
+
+    /// Build the union energy grid over the elements of the materials, must be called before
+    /// the material cross sections are evaluated.
+    void build_union_grid(const std::vector<material_data> &materials);
+
+    /// Build the sampling tables of the elements of the materials.
+    void build_sampling_tables(const std::vector<material_data> &materials);
+
+    /// Find the interval of the union energy grid containing the energy.
+    /// @return the interval index and the position in the interval
+    std::pair<std::size_t, double> union_grid_position(double energy) const;
+
     double material_macro_xs(const material_data &mat, double energy) const;
 
-    std::pair<double, const element &> sample_material(const material_data &mat, double energy,
-                                                       uint64_t &prng_state) const;
+    material_sample sample_material(const material_data &mat, double energy,
+                                    uint64_t &prng_state) const;
+
+    /// Sample the collision element, the material cross sections are looked up only when the
+    /// material or the energy differ from the cached ones.
+    material_sample sample_material(const material_data &mat, double energy, uint64_t &prng_state,
+                                    material_xs_cache &cache) const;
 
     void material_calculate_missing_values(material_data &mat) const;
 
+    /// Tabulate the macroscopic cross sections of the material on the union energy grid, must be
+    /// called after build_union_grid.
+    void material_build_tables(material_data &mat) const;
+
     // deprecated! use endf
     static data_library load_xcom_data(std::filesystem::path path);
 
+    /// Read the xsdir file. Only the locations and the atomic weights of the elements are read,
+    /// the tables are loaded later by load_elements.
     static data_library load_ace_data(std::filesystem::path path);
+
+    /// Convert the whole ACE library to the binary cache format.
+    /// @param xsdir_path the xsdir file of the library
+    /// @param cache_path the output file, replaced atomically
+    static void write_binary_data(std::filesystem::path xsdir_path,
+                                  std::filesystem::path cache_path);
+
+    /// Map the binary cache of the ACE library into memory, the tables are used directly from the
+    /// mapping. The cache is rebuilt when it is missing, has another version or was made from
+    /// different source files.
+    /// @param xsdir_path the xsdir file of the library
+    /// @param cache_path the binary cache
+    static data_library load_binary_data(std::filesystem::path xsdir_path,
+                                         std::filesystem::path cache_path);
 };
 
 parsed_material parse_material_string(const std::string_view &material);
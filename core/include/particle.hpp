@@ -2,15 +2,34 @@
 #include "geometry.hpp"
 #include "material.hpp"
 
+#include <limits>
 #include <vector>
 
 namespace projector {
 
+/// Object index of the steps outside of all objects
+constexpr std::size_t no_object = std::numeric_limits<std::size_t>::max();
+
 struct particle_history {
     std::vector<vec3> points;
     std::vector<double> energies;
     std::vector<cross_section> interactions;
     std::vector<std::size_t> elements;
+    std::vector<std::size_t> objects;     ///< object of the flight ending in the point
+    std::vector<std::size_t> generations; ///< interactions before the flight ending in the point
+};
+
+/// Single step of a particle history - the flight between two consecutive history points and the
+/// interaction that happened at the end of the flight.
+struct particle_step {
+    vec3 start;                     ///< start point of the flight
+    vec3 end;                       ///< end point of the flight, location of the interaction
+    double energy;                  ///< energy of the particle during the flight
+    double end_energy;              ///< energy of the particle after the interaction
+    cross_section interaction;      ///< interaction at the end point
+    std::size_t element;            ///< atomic number of the interacting element (0 if none)
+    std::size_t object = no_object; ///< index of the object of the flight, no_object in void
+    std::size_t generation = 0;     ///< interactions of the particle before the flight
 };
 
 struct particle {
@@ -22,18 +41,44 @@ struct particle {
 
     uint64_t prng_state;
 
+    /// Whether to keep the full history. If false, only the last step is kept.
+    bool record_history;
+
     particle_history history;
 
+    /// Material cross sections at the current energy, cleared for each new particle
+    material_xs_cache xs_cache;
+
     double &energy();
 
     vec3 &position();
 
+    /// Get a step of the history.
+    /// @param index index of the history point the step ends in, must be at least 1
+    particle_step step(std::size_t index) const;
+
+    /// Get the last step of the history, there must be at least one.
+    particle_step last_step() const;
+
     void save_particle(const std::filesystem::path path) const;
 
-    void photon_interaction(const element &elem);
+    void photon_interaction(const element &elem, const sampled_xs &xs);
 
-    void advance(double distance);
+    /// Move the particle along its direction.
+    /// @param distance the flight distance
+    /// @param object index of the object the particle flies through, no_object in void
+    void advance(double distance, std::size_t object);
 };
 
+/// Sample a photon interaction with an element, updates the energy and direction in place.
+///
+/// @param elem the interacting element
+/// @param xs cross sections of the element at the photon energy
+/// @param energy the photon energy, updated to the energy after the interaction
+/// @param direction the photon direction, updated to the direction after the interaction
+/// @param prng_state the PRNG state of the photon
+/// @return the sampled interaction
+cross_section sample_photon_interaction(const element &elem, const sampled_xs &xs,
+                                        double &energy, vec3 &direction, uint64_t &prng_state);
 
 } // namespace projector
\ No newline at end of file
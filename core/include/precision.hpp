@@ -0,0 +1,18 @@
+#pragma once
+
+namespace projector {
+
+/// Scalar type of the tally accumulators, selected by the PROJECTOR_PRECISION build option.
+///
+/// The mixed precision build scores the steps into float accumulators, which halves the memory
+/// traffic of the scoring. The accumulators are reduced into double totals after every transport
+/// pass of a limited particle count, and at the end of each batch, so the float sums stay short
+/// for any batch size. Transport (positions, directions, cross sections) always runs in double,
+/// the surface crossings rely on its resolution.
+#ifdef PROJECTOR_MIXED_PRECISION
+using tally_real = float;
+#else
+using tally_real = double;
+#endif
+
+} // namespace projector
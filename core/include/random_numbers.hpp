@@ -3,12 +3,30 @@
 
 namespace projector {
 
+/// Number of PRNG steps reserved for a single particle stream
+constexpr uint64_t prng_stream_stride = 152917;
+
 void seed_master_prng(uint64_t seed);
 
 uint64_t generate_prng_seed();
 
+/// Skip the PRNG state ahead, takes logarithmic time in the number of steps.
+///
+/// @param state the state to advance
+/// @param delta number of steps to skip
+void skip_prng(uint64_t &state, uint64_t delta);
+
+/// Get the initial PRNG state of a particle stream. The stream of particle `index` starts
+/// `index * prng_stream_stride` steps after the seed, so the state does not depend on the order
+/// in which the particles are created.
+///
+/// @param seed the simulation seed
+/// @param index index of the particle
+/// @return initial PRNG state of the particle
+uint64_t prng_stream_state(uint64_t seed, uint64_t index);
+
 double prng_double(uint64_t &state);
 
 double prng_double();
 
-} // namespace projector
\ No newline at end of file
+} // namespace projector
@@ -3,10 +3,36 @@
 
 namespace projector {
 
+/// Sample a source particle. Each particle is sampled from its own PRNG stream, so this can be
+/// called in any order and from any thread.
+/// @param env the environment with sources
+/// @param index global index of the particle
+/// @param p the particle to overwrite, its history storage is reused
+void sample_source_particle(const environment &env, std::size_t index, particle &p);
+
 void initialize_runtime(environment &env, int thread_count);
 
+/// Set up the next batch of particles. The particles are sampled lazily by the transport, they
+/// are stored in env.particles only when the particle paths are saved.
+/// @return false if all particles were already sourced
+bool source_batch(environment &env);
+
+/// Add the scores the tallies accumulate in reduced precision to their data. Called by the
+/// engines after each transport pass of env.tally_flush_particles particles.
+void flush_tallies(environment &env);
+
 void calculate_particle_histories(environment &env);
 
+/// Event based alternative to calculate_particle_histories. Particles are kept in a structure of
+/// arrays bank and processed in stages (cross section lookup, distance calculation, advance,
+/// collision), each stage over all particles waiting for it. Produces the same particle histories.
+void calculate_particle_events(environment &env);
+
+/// Finish the current batch - update tally statistics, save particle paths and release the
+/// particles of the batch.
+/// @return true if the target relative error was reached on all convergence tallies
+bool finish_batch(environment &env);
+
 void process_tallies(environment &env);
 
 void save_data(environment &env);
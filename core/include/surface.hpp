@@ -1,5 +1,7 @@
 #pragma once
 
+#include "surface_kernels.hpp"
+
 #include <Eigen/Dense>
 #include <utility>
 
@@ -7,6 +9,8 @@ namespace projector {
 
 using vec3 = Eigen::Vector3d;
 
+struct csg_program;
+
 /// @brief Abstract interface class representing a quadric surface
 ///
 /// This class acts as the base class for additional surface classes.
@@ -40,6 +44,12 @@ struct surface {
     /// @return pair of min and max points of the bounding box.
     ///
     virtual std::pair<vec3, vec3> bounding_box() const = 0;
+
+    /// Append the surface to the compiled program of a geometry.
+    ///
+    /// @param program The program, the surface pushes its inside test.
+    ///
+    virtual void compile(csg_program &program) const = 0;
 };
 
 /// A generic surface defined by a point and a normal vector
@@ -54,6 +64,7 @@ class plane : public surface {
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// Generic axis alligned ellipsoid, defined by a center point and 3 radii.
@@ -61,14 +72,15 @@ class ellipsoid : public surface {
 
     vec3 center;
     vec3 radii;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    ellipsoid(vec3 center, double a, double b, double c)
-        : center(center), radii({a, b, c}) {}
+    ellipsoid(vec3 center, double a, double b, double c);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// X axis aligned elliptic cone, defined by center point and parameters a, b, c
@@ -78,14 +90,15 @@ class x_cone : public surface {
     double a;
     double b;
     double c;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    x_cone(vec3 center, double a, double b, double c)
-        : center(center), a(a), b(b), c(c) {}
+    x_cone(vec3 center, double a, double b, double c);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// Y axis aligned elliptic cone, defined by center point and parameters a, b, c
@@ -95,14 +108,15 @@ class y_cone : public surface {
     double a;
     double b;
     double c;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    y_cone(vec3 center, double a, double b, double c)
-        : center(center), a(a), b(b), c(c) {}
+    y_cone(vec3 center, double a, double b, double c);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// Z axis aligned elliptic cone, defined by center point and parameters a, b, c
@@ -112,14 +126,15 @@ class z_cone : public surface {
     double a;
     double b;
     double c;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    z_cone(vec3 center, double a, double b, double c)
-        : center(center), a(a), b(b), c(c) {}
+    z_cone(vec3 center, double a, double b, double c);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// X axis aligned elliptic cylinder, defined by center point and 2 radii a, b
@@ -128,13 +143,15 @@ class x_cylinder : public surface {
     vec3 center;
     double a;
     double b;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    x_cylinder(vec3 center, double a, double b) : center(center), a(a), b(b) {}
+    x_cylinder(vec3 center, double a, double b);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// Y axis aligned elliptic cylinder, defined by center point and 2 radii a, b
@@ -143,13 +160,15 @@ class y_cylinder : public surface {
     vec3 center;
     double a;
     double b;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
 
   public:
-    y_cylinder(vec3 center, double a, double b) : center(center), a(a), b(b) {}
+    y_cylinder(vec3 center, double a, double b);
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
 /// Z axis aligned elliptic cylinder, defined by center point and 2 radii a, b
@@ -158,14 +177,47 @@ class z_cylinder : public surface {
     vec3 center;
     double a;
     double b;
+    axis_quadric_coeffs coeffs; ///< canonical form, computed once in the constructor
+
+  public:
+    z_cylinder(vec3 center, double a, double b);
+
+    double distance_along_line(const vec3 &p, const vec3 &dir) const final;
+    bool point_inside(const vec3 &p) const final;
+    std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
+};
+
+/// Axis aligned box, defined by the min and max corners. Evaluated by the slab test.
+class box : public surface {
+
+    vec3 min;
+    vec3 max;
 
   public:
-    z_cylinder(vec3 center, double a, double b) : center(center), a(a), b(b) {}
+    box(vec3 min, vec3 max) : min(min), max(max) {}
 
     double distance_along_line(const vec3 &p, const vec3 &dir) const final;
     bool point_inside(const vec3 &p) const final;
     std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
 };
 
+/// General quadric surface, defined by a center point and 10 coefficients A, B, C, D, E, F, G, H,
+/// J, K. Relative to the center, the surface is
+/// A x^2 + B y^2 + C z^2 + D xy + E yz + F xz + G x + H y + J z + K = 0
+/// Can express rotated cylinders and cones, or any other second order surface.
+class quadric : public surface {
+
+    quadric_coeffs coeffs;
+
+  public:
+    quadric(vec3 center, const std::array<double, 10> &k) : coeffs{center, k} {}
+
+    double distance_along_line(const vec3 &p, const vec3 &dir) const final;
+    bool point_inside(const vec3 &p) const final;
+    std::pair<vec3, vec3> bounding_box() const final;
+    void compile(csg_program &program) const final;
+};
 
 } // namespace projector
\ No newline at end of file
@@ -0,0 +1,287 @@
+#pragma once
+#include "constants.hpp"
+
+#include <Eigen/Dense>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace projector {
+
+using vec3 = Eigen::Vector3d;
+
+/// Plane stored by value, inside is where (p - point) . normal < 0
+struct plane_coeffs {
+    vec3 point;
+    vec3 normal;
+};
+
+/// Axis aligned quadric stored by value, inside is where
+/// scale_x * (x - x_0)^2 + scale_y * (y - y_0)^2 + scale_z * (z - z_0)^2 < r
+struct axis_quadric_coeffs {
+    vec3 center;
+    vec3 scale;
+    double r;
+};
+
+/// General quadric stored by value, relative to the center point. With (x, y, z) = p - center,
+/// inside is where
+/// A x^2 + B y^2 + C z^2 + D xy + E yz + F xz + G x + H y + J z + K < 0
+struct quadric_coeffs {
+    vec3 center;
+    std::array<double, 10> k; ///< coefficients A, B, C, D, E, F, G, H, J, K
+};
+
+/// Planes in structure of arrays layout, used by the batched kernels
+struct plane_set {
+    std::vector<double> x, y, z;    ///< point on the plane
+    std::vector<double> nx, ny, nz; ///< normal of the plane
+
+    std::size_t size() const { return x.size(); }
+
+    void push_back(const plane_coeffs &plane);
+};
+
+/// Axis aligned quadrics in structure of arrays layout, used by the batched kernels
+struct axis_quadric_set {
+    std::vector<double> x, y, z;    ///< center of the quadric
+    std::vector<double> sx, sy, sz; ///< scale of the squared coordinates
+    std::vector<double> r;
+
+    std::size_t size() const { return x.size(); }
+
+    void push_back(const axis_quadric_coeffs &quadric);
+};
+
+/// Axis aligned boxes in structure of arrays layout, used by the batched kernels
+struct box_set {
+    std::vector<double> min_x, min_y, min_z;
+    std::vector<double> max_x, max_y, max_z;
+
+    std::size_t size() const { return min_x.size(); }
+
+    void push_back(const vec3 &min, const vec3 &max);
+};
+
+/// General quadrics in structure of arrays layout, used by the batched kernels
+struct quadric_set {
+    std::vector<double> x, y, z;             ///< center of the quadric
+    std::array<std::vector<double>, 10> k; ///< coefficients A, B, C, D, E, F, G, H, J, K
+
+    std::size_t size() const { return x.size(); }
+
+    void push_back(const quadric_coeffs &quadric);
+};
+
+/// Packet of rays in structure of arrays layout. Point queries do not read the directions,
+/// distance queries read the directions and their inverses.
+struct ray_packet {
+    const double *x, *y, *z;
+    const double *u, *v, *w;
+    std::size_t size;
+
+    /// Inverted directions (1 / u, 1 / v, 1 / w), read by the box distance kernel. They are
+    /// computed once per packet by the caller, not for every box.
+    const double *inv_u = nullptr, *inv_v = nullptr, *inv_w = nullptr;
+
+    /// Packet of rays [first, first + count)
+    ray_packet slice(std::size_t first, std::size_t count) const;
+};
+
+//=======================================
+// Building blocks, shared by the surfaces and the batched kernels. All branches are written
+// as selects, so the loops using them stay vectorizable.
+//=======================================
+
+/// Distance along the ray to a plane, given the signed offset (n . (p - point)) and n . dir
+inline double plane_distance(double offset, double denom) {
+    // if the denominator is zero, the ray is parallel
+    return denom != 0.0 ? -offset / denom : constants::infinity;
+}
+
+/// Distance along the ray to a quadric, from the roots of e * t^2 + f * t + g = 0
+inline double quadric_root(double e, double f, double g) {
+    double discriminant = f * f - 4 * e * g;
+
+    // if e is zero we never intersect, negative discriminant has only complex roots
+    bool hit = e != 0.0 && discriminant >= 0.0;
+
+    // keep the masked lanes finite, the root is taken for all lanes so it stays out of a branch
+    double root = std::sqrt(discriminant > 0.0 ? discriminant : 0.0);
+    double denom = hit ? 2 * e : 1.0;
+
+    double dist1 = (-f + root) / denom;
+    double dist2 = (-f - root) / denom;
+
+    // if both solutions are positive, return the smaller one, otherwise the larger one
+    double nearer = dist1 < dist2 ? dist1 : dist2;
+    double farther = dist1 < dist2 ? dist2 : dist1;
+    double dist = (dist1 > 0.0 && dist2 > 0.0) ? nearer : farther;
+
+    // the miss is added instead of selected, a select of the constant would move the divisions
+    // into a branch
+    return dist + (hit ? 0.0 : constants::infinity);
+}
+
+/// One axis of the slab test, narrows the [entry, exit] interval of the ray by the slab
+/// [lo, hi]. The ray is given by the point coordinate and the inverted direction.
+inline void slab_axis(double p, double inv_dir, double lo, double hi, double &entry,
+                      double &exit) {
+    double t1 = (lo - p) * inv_dir;
+    double t2 = (hi - p) * inv_dir;
+
+    // a NaN happens when the ray lies in the slab plane, it is ignored like by std::fmin and
+    // std::fmax, the bounds themselves are never NaN. Written as selects, which vectorize unlike
+    // the library calls.
+    double near = (t2 != t2 || t1 < t2) ? t1 : t2;
+    double far = (t2 != t2 || t1 > t2) ? t1 : t2;
+
+    entry = near > entry ? near : entry;
+    exit = far < exit ? far : exit;
+}
+
+/// Slab test of a ray against an axis aligned box.
+///
+/// @param inv_dir the inverted direction of the ray (1 / dir per component)
+/// @return entry and exit distance along the ray, the ray misses the box if entry > exit
+inline std::pair<double, double> slab_intersect(const vec3 &min, const vec3 &max, const vec3 &p,
+                                                const vec3 &inv_dir) {
+    double entry = -constants::infinity;
+    double exit = constants::infinity;
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        slab_axis(p[i], inv_dir[i], min[i], max[i], entry, exit);
+    }
+
+    return {entry, exit};
+}
+
+/// Distance to the boundary of a box from the slab test result. Inside the box, this is the exit
+/// distance, outside the entry distance. Infinity if the box is missed or behind the ray.
+inline double box_distance(double entry, double exit) {
+    bool hit = entry <= exit && exit >= 0.0;
+    return hit ? (entry >= 0.0 ? entry : exit) : constants::infinity;
+}
+
+/// Value of the axis aligned quadric at offset (x, y, z) from its center, negative inside
+inline double axis_quadric_value(double x, double y, double z, double sx, double sy, double sz,
+                                 double r) {
+    return sx * x * x + sy * y * y + sz * z * z - r;
+}
+
+/// Distance along the ray (u, v, w) to the axis aligned quadric, from offset (x, y, z)
+inline double axis_quadric_distance(double x, double y, double z, double u, double v, double w,
+                                    double sx, double sy, double sz, double r) {
+    double e = sx * u * u + sy * v * v + sz * w * w;
+    double f = 2.0 * (sx * x * u + sy * y * v + sz * z * w);
+    double g = axis_quadric_value(x, y, z, sx, sy, sz, r);
+
+    return quadric_root(e, f, g);
+}
+
+/// Value of the general quadric at offset (x, y, z) from its center, negative inside
+template <typename K>
+inline double quadric_value(double x, double y, double z, const K &k) {
+    return k[0] * x * x + k[1] * y * y + k[2] * z * z + k[3] * x * y + k[4] * y * z +
+           k[5] * x * z + k[6] * x + k[7] * y + k[8] * z + k[9];
+}
+
+/// Distance along the ray (u, v, w) to the general quadric, from offset (x, y, z)
+template <typename K>
+inline double quadric_distance(double x, double y, double z, double u, double v, double w,
+                               const K &k) {
+    double e = k[0] * u * u + k[1] * v * v + k[2] * w * w + k[3] * u * v + k[4] * v * w +
+               k[5] * u * w;
+    double f = 2.0 * (k[0] * x * u + k[1] * y * v + k[2] * z * w) + k[3] * (x * v + y * u) +
+               k[4] * (y * w + z * v) + k[5] * (x * w + z * u) + k[6] * u + k[7] * v + k[8] * w;
+    double g = quadric_value(x, y, z, k);
+
+    return quadric_root(e, f, g);
+}
+
+//=======================================
+// Single ray, single surface
+//=======================================
+
+inline bool plane_inside(const plane_set &planes, std::size_t i, const vec3 &p) {
+    return (p.x() - planes.x[i]) * planes.nx[i] + (p.y() - planes.y[i]) * planes.ny[i] +
+               (p.z() - planes.z[i]) * planes.nz[i] <
+           0.0;
+}
+
+inline bool axis_quadric_inside(const axis_quadric_set &quadrics, std::size_t i, const vec3 &p) {
+    return axis_quadric_value(p.x() - quadrics.x[i], p.y() - quadrics.y[i],
+                              p.z() - quadrics.z[i], quadrics.sx[i], quadrics.sy[i],
+                              quadrics.sz[i], quadrics.r[i]) < 0.0;
+}
+
+inline bool box_inside(const box_set &boxes, std::size_t i, const vec3 &p) {
+    return p.x() > boxes.min_x[i] && p.x() < boxes.max_x[i] && p.y() > boxes.min_y[i] &&
+           p.y() < boxes.max_y[i] && p.z() > boxes.min_z[i] && p.z() < boxes.max_z[i];
+}
+
+inline bool quadric_inside(const quadric_set &quadrics, std::size_t i, const vec3 &p) {
+    std::array<double, 10> k;
+    for (std::size_t c = 0; c < k.size(); ++c) {
+        k[c] = quadrics.k[c][i];
+    }
+
+    return quadric_value(p.x() - quadrics.x[i], p.y() - quadrics.y[i], p.z() - quadrics.z[i],
+                         k) < 0.0;
+}
+
+//=======================================
+// Single ray, all surfaces of a set
+//=======================================
+
+/// Nearest non-negative distance along the ray to any of the planes, infinity if none is hit.
+double nearest_plane_distance(const plane_set &planes, const vec3 &p, const vec3 &dir);
+
+/// Nearest non-negative distance along the ray to any of the quadrics, infinity if none is hit.
+double nearest_axis_quadric_distance(const axis_quadric_set &quadrics, const vec3 &p,
+                                     const vec3 &dir);
+
+/// Nearest non-negative distance along the ray to any of the quadrics, infinity if none is hit.
+double nearest_quadric_distance(const quadric_set &quadrics, const vec3 &p, const vec3 &dir);
+
+/// Nearest non-negative distance along the ray to any of the box boundaries, infinity if none
+/// is hit.
+double nearest_box_distance(const box_set &boxes, const vec3 &p, const vec3 &dir);
+
+//=======================================
+// Packet of rays, single surface
+//=======================================
+
+/// Inside test of the points of the packet against the plane with given index.
+void plane_inside(const plane_set &planes, std::size_t i, const ray_packet &rays, uint8_t *inside);
+
+/// Inside test of the points of the packet against the quadric with given index.
+void axis_quadric_inside(const axis_quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                         uint8_t *inside);
+
+/// Inside test of the points of the packet against the box with given index.
+void box_inside(const box_set &boxes, std::size_t i, const ray_packet &rays, uint8_t *inside);
+
+/// Inside test of the points of the packet against the quadric with given index.
+void quadric_inside(const quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                    uint8_t *inside);
+
+/// Lower the nearest distances of the rays by the non-negative distances to the plane.
+void nearest_plane_distance(const plane_set &planes, std::size_t i, const ray_packet &rays,
+                            double *nearest);
+
+/// Lower the nearest distances of the rays by the non-negative distances to the quadric.
+void nearest_axis_quadric_distance(const axis_quadric_set &quadrics, std::size_t i,
+                                   const ray_packet &rays, double *nearest);
+
+/// Lower the nearest distances of the rays by the non-negative distances to the box boundary.
+void nearest_box_distance(const box_set &boxes, std::size_t i, const ray_packet &rays,
+                          double *nearest);
+
+/// Lower the nearest distances of the rays by the non-negative distances to the quadric.
+void nearest_quadric_distance(const quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                              double *nearest);
+
+} // namespace projector
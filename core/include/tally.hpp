@@ -1,9 +1,13 @@
 #pragma once
 #include "particle.hpp"
+#include "precision.hpp"
+#include "tally_buffer.hpp"
+#include "tally_filter.hpp"
+#include "uniform_mesh.hpp"
 
 #include <filesystem>
+#include <memory>
 #include <optional>
-#include <variant>
 #include <vector>
 
 namespace projector {
@@ -20,11 +24,56 @@ struct tally {
     /// Initialize the tally, should be called only once at the beginning.
     virtual void init_tally() = 0;
 
-    /// Add single particle data to the tally results.
+    /// Score a single step of a particle. Called from the transport loop for every step, so the
+    /// full particle history does not have to be kept. Must be safe to call from multiple threads.
+    ///
+    /// @param step The step to score
+    ///
+    virtual void score_step(const particle_step &step) = 0;
+
+    /// Mesh the tally is scored on. The steps of tallies sharing a mesh are looked up in the mesh
+    /// once and passed to score_mesh_step instead of score_step.
+    ///
+    /// @return The mesh of the tally, nullptr if it is not scored on a mesh
+    ///
+    virtual const uniform_mesh *mesh() const { return nullptr; }
+
+    /// Whether the tally scores the tracks of the steps, so they have to be traversed in the mesh.
+    /// Otherwise the tally scores the interactions at the end points of the steps.
+    virtual bool scores_tracks() const { return false; }
+
+    /// Score a single step with its mesh lookups, only used by tallies with a mesh. Must be safe to
+    /// call from multiple threads.
+    ///
+    /// @param step The step to score, with the cells of the tally mesh
+    ///
+    virtual void score_mesh_step(const mesh_step &) {}
+
+    /// Add whole particle history to the tally results, scores each step of the history.
     ///
     /// @param p The particle to add
     ///
-    virtual void add_particle(const particle &p) = 0;
+    void add_particle(const particle &p);
+
+    /// Add the scores accumulated in reduced precision to the tally data, so their sums stay
+    /// short. Called by the runtime between the transport passes, never during scoring.
+    ///
+    virtual void flush_scores() {}
+
+    /// Finish a batch of particles, update the batch statistics of the tally.
+    ///
+    /// @param particle_count The number of particles in the finished batch
+    ///
+    virtual void end_batch(std::size_t particle_count) = 0;
+
+    /// Get the relative error of the tally, based on the batch statistics. It is the largest
+    /// relative error of the values scored enough, so no noisy value is hidden by the others.
+    ///
+    /// @param score_fraction Only values with a mean batch score of at least this fraction of the
+    /// largest mean score of the same data column are checked, 0 to check all scored values
+    /// @return The relative error, infinity if there are not enough batches
+    ///
+    virtual double relative_error(double score_fraction) const = 0;
 
     /// Finalize the resulting data. Should be called only once at the end.
     ///
@@ -41,9 +90,9 @@ struct tally {
 ///
 /// Not all scores are supported by all tally types!
 enum class tally_score {
-    /// the total flux of the particles
+    /// the flux of the particles, track length estimate (track length per volume)
     flux,
-    /// average energy of a particle
+    /// track length weighted average energy of the particles
     average_energy,
     /// total interaction counts
     interaction_counts,
@@ -51,82 +100,192 @@ enum class tally_score {
     deposited_energy
 };
 
+/// @brief How the tallies accumulate the scores of particles transported in parallel.
+enum class tally_accumulation {
+    /// shared accumulators, updated atomically
+    atomic,
+    /// accumulators private to each thread, reduced at the end of each batch
+    thread_private,
+    /// private fixed point accumulators, the results do not depend on the thread count. The
+    /// accumulators keep 2^-32 resolution, so the scores of a single thread in a single cell are
+    /// valid up to 2^31 (MeV or cm) per batch. Larger sums are detected and reported by an error
+    /// at the end of the batch, a smaller batch size keeps them in range.
+    deterministic
+};
+
 /// @brief Basic uniform mesh tally. Divides space into uniform grid.
 ///
 /// The tally is defined by start and stop points and the resolution of the grid to divide the
 /// measured volume into. It supports these scores: flux, average_energy, interaction_counts
-class uniform_mesh_tally : public tally {
+/// and deposited_energy. Filters split the scores of each cell into the combinations of their bins.
+///
+/// @tparam Real scalar type of the accumulators of the energy scores during a batch
+template <typename Real>
+class basic_uniform_mesh_tally : public tally {
 
     std::string id; /// the user supplied id of the tally
 
-    bounding_box bounds; /// the bounds of the tally
+    uniform_mesh grid; /// the cells of the tally
 
-    coord3 resolution; /// resolution for each axis
+    std::size_t cell_count; /// the number of grid cells
 
     std::size_t stride; /// the number of data per grid cell
 
-    /// Stored data. Linear storage in vector.
-    // Indexed so that coordinate x,y,z maps to index i:
-    //     i = z * (resolution.x() * resolution.y()) + y * resolution.x() + x
-    // Stored data is either double or int, depending on the score
-    std::vector<std::variant<double, int>> data;
+    std::vector<const tally_filter *> filters; /// filters of the tally, the last varies fastest
+
+    std::size_t filter_bin_count = 1; /// the number of combinations of the filter bins
+
+    /// Stored data, a structure of arrays - every value of a cell has its own array.
+    // Cell x,y,z has index c = z * (resolution.x() * resolution.y()) + y * resolution.x() + x,
+    // value k of the cell in the filter bin combination f is stored at
+    // (f * stride + k) * cell_count + c. Only the array of the score type is allocated, counts for
+    // the interaction counts, values for the other scores
+    std::vector<double> values;
+    std::vector<uint64_t> counts;
+
+    /// Values of the current transport pass, reduced into the data by flush_scores and at the
+    /// end of the batch.
+    // Allocated only for the atomic accumulation of the values in reduced precision, at the same
+    // indices. Double values are added atomically to the data itself
+    std::vector<Real> accumulated;
+
+    tally_accumulation accumulation;
+
+    /// Scores of a single thread, used by the private accumulations
+    struct thread_buffer {
+        paged_buffer<Real> values;      ///< energy scores of the thread private accumulation
+        paged_buffer<int64_t> integers; ///< counts and fixed point energy scores
+        bool overflow = false;          ///< whether a fixed point score did not fit
+    };
+
+    std::vector<thread_buffer> buffers; /// one buffer per thread
 
     tally_score score;
 
-    /// Determine cell coordinates of a point
-    /// @param point the point to evaluate
-    /// @return returns empty if point is outside the grid, otherwise returns coordinates
-    ///
-    std::optional<coord3> determine_cell(const vec3 &point) const;
+    /// Batch statistics, allocated at the end of the first batch.
+    // Per particle normalized batch values are summed, to get the mean and its variance
+    std::size_t batches = 0;
+    std::vector<double> previous_total; /// data total at the end of previous batch
+    std::vector<double> batch_sum;      /// sum of normalized batch values
+    std::vector<double> batch_sum_sq;   /// sum of squared normalized batch values
 
-    /// Calculate the base index for given coordinate
-    /// @param coord the coordinate to evaluate
-    /// @return the base index for given coordinate
-    ///
-    std::size_t calculate_index(const coord3 &c) const;
+    /// Number of the stored data
+    std::size_t data_size() const { return filter_bin_count * stride * cell_count; }
+
+    /// Get the stored data at index, regardless of its type
+    double data_at(std::size_t index) const;
 
-    /// Calculate intersection values for all grid crossings of a segment
-    /// @param start start point of the segment
-    /// @param end end point of a segment
-    /// @return interpolation coefficients for all grid crossings
-    std::vector<double> calculate_intersections(const vec3 &start, const vec3 &end) const;
+    /// Calculate relative error of the data at index
+    /// @param index index of the data
+    /// @return relative error of the data, infinity if undefined
+    double relative_error_at(std::size_t index) const;
 
-    /// Increment the data by one at a given index
+    /// Increment the count at a given index by one
     /// @param index index to increment
-    void increment_index(std::size_t index);
+    void increment_count(std::size_t index);
 
     /// Add value at a given index
     /// @param index index to update
     /// @param value value to add to index
-    void add_index(std::size_t index, double value);
+    void add_value(std::size_t index, double value);
+
+    /// Add the accumulated scores to the data in double and reset the accumulators
+    void reduce_accumulated();
+
+    /// Add the scores of the thread buffers to the data and reset the buffers. The pages are
+    /// reduced in parallel, the buffers of each page in the order of the threads.
+    void reduce_buffers();
+
+    /// Find the data of the filter bins of a step
+    /// @param step step with the bins of all filters
+    /// @return offset of the data of the bin combination, empty if a filter rejects the step
+    std::optional<std::size_t> filter_offset(const mesh_step &step) const;
 
-    /// Add particle interactions to tally (tally must be have interaction count score setup)
-    /// @param p particle to add
-    void add_particle_interactionwise(const particle &p);
+    /// Add interaction at the end of the step to tally, compiled for each interaction score
+    /// @param step step to add
+    /// @param offset offset of the data of the filter bins of the step
+    template <tally_score S>
+    void score_interaction(const mesh_step &step, std::size_t offset);
 
-    /// Add particle segments to tally
-    /// @param p particle to add
-    void add_particle_segmentwise(const particle &p);
+    /// Add the step segment to tally, compiled for each track score. Scores the track length in
+    /// each of the cells crossed by the segment
+    /// @param step step to add
+    /// @param offset offset of the data of the filter bins of the step
+    template <tally_score S>
+    void score_segment(const mesh_step &step, std::size_t offset);
 
 public:
 
-    /// Default and only constructor for uniform_mesh_tally
+    /// Default and only constructor for basic_uniform_mesh_tally
     /// @param user_id User supplied ID
     /// @param start The start point of the tally space
     /// @param end  The end point of the tally space
     /// @param res Resolution (number of cells) per axis
     /// @param sc  The score to evaluate
+    /// @param acc How to accumulate the scores of the threads
+    /// @param filt Filters of the scored steps, must outlive the tally
     ///
-    uniform_mesh_tally(std::string user_id, const vec3 &start, const vec3 &end, const coord3 &res,
-                       tally_score sc);
+    basic_uniform_mesh_tally(std::string user_id, const vec3 &start, const vec3 &end,
+                             const coord3 &res, tally_score sc,
+                             tally_accumulation acc = tally_accumulation::atomic,
+                             std::vector<const tally_filter *> filt = {});
 
     void init_tally() final;
 
-    void add_particle(const particle &p) final;
+    void score_step(const particle_step &step) final;
+
+    const uniform_mesh *mesh() const final;
+
+    bool scores_tracks() const final;
+
+    void score_mesh_step(const mesh_step &step) final;
+
+    void flush_scores() final;
+
+    void end_batch(std::size_t particle_count) final;
+
+    double relative_error(double score_fraction) const final;
 
     void finalize_data() final;
 
     void save_tally(const std::filesystem::path path) const final;
 };
 
+/// Uniform mesh tally of the precision selected by the build
+using uniform_mesh_tally = basic_uniform_mesh_tally<tally_real>;
+
+/// @brief Fused scoring of the steps into all tallies of a simulation.
+///
+/// Tallies on identical meshes are grouped, each step is looked up once per group - the mesh
+/// traversal and the cell search are shared by all tallies of the group. The bins of the filters
+/// are found once per step and shared by all tallies. Tallies without a mesh score the steps
+/// themselves.
+class tally_scorer {
+
+    struct mesh_group {
+        const uniform_mesh *mesh;
+        bool tracks;       ///< whether any tally of the group scores tracks
+        bool interactions; ///< whether any tally of the group scores interactions
+        std::vector<tally *> tallies;
+    };
+
+    std::vector<mesh_group> groups;
+
+    std::vector<tally *> other_tallies;
+
+    std::vector<const tally_filter *> filters;
+
+public:
+    tally_scorer() = default;
+
+    /// Group the tallies, they and the filters must outlive the scorer
+    /// @param tallies the scored tallies
+    /// @param filt the filters used by the tallies, indexed by their slots
+    explicit tally_scorer(const std::vector<std::unique_ptr<tally>> &tallies,
+                          const std::vector<std::unique_ptr<tally_filter>> &filt = {});
+
+    /// Score a step into all tallies, safe to call from multiple threads
+    void score_step(const particle_step &step) const;
+};
+
 } // namespace projector
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace projector {
+
+/// Accumulator private to a single thread, split into fixed size pages.
+///
+/// A dense buffer allocates all of its pages up front. A sparse buffer allocates a page on the
+/// first score into it, so a thread scoring only a part of a large mesh keeps only that part in
+/// memory. The pages are zero initialized, the buffer is aligned to keep the buffers of different
+/// threads out of the same cache line.
+template <typename T>
+class alignas(64) paged_buffer {
+
+    std::vector<std::unique_ptr<T[]>> pages;
+
+public:
+    static constexpr std::size_t page_size = 4096;
+
+    /// Allocate the page table
+    /// @param size number of values of the buffer
+    /// @param dense whether to allocate all pages now
+    void resize(std::size_t size, bool dense) {
+        pages.clear();
+        pages.resize((size + page_size - 1) / page_size);
+
+        if (dense) {
+            for (auto &page : pages) {
+                page = std::make_unique<T[]>(page_size);
+            }
+        }
+    }
+
+    std::size_t page_count() const { return pages.size(); }
+
+    /// Get a page of the buffer
+    /// @return the page values, nullptr if nothing was scored into the page yet
+    T *page(std::size_t index) { return pages[index].get(); }
+
+    void add(std::size_t index, T value) {
+        auto &page = pages[index / page_size];
+
+        if (!page) {
+            page = std::make_unique<T[]>(page_size);
+        }
+
+        page[index % page_size] += value;
+    }
+
+    /// Add to a value of an integer buffer, unless the sum overflows
+    /// @return false if the sum overflows, the value is then left unchanged
+    bool add_checked(std::size_t index, T value) {
+        auto &page = pages[index / page_size];
+
+        if (!page) {
+            page = std::make_unique<T[]>(page_size);
+        }
+
+        T &target = page[index % page_size];
+
+        if (value > 0 ? target > std::numeric_limits<T>::max() - value
+                      : target < std::numeric_limits<T>::min() - value) {
+            return false;
+        }
+
+        target += value;
+        return true;
+    }
+};
+
+} // namespace projector
@@ -0,0 +1,47 @@
+#pragma once
+#include "particle.hpp"
+
+#include <string>
+#include <vector>
+
+namespace projector {
+
+/// @brief The quantities the scored steps can be filtered by.
+enum class filter_type {
+    /// energy of the particle during the step
+    energy,
+    /// interaction at the end of the step
+    interaction,
+    /// object the step passes through
+    object,
+    /// material of the object the step passes through
+    material,
+    /// number of interactions of the particle before the step, 0 for uncollided particles
+    generation
+};
+
+/// @brief Filter splitting the scores of a tally into bins.
+///
+/// Each step falls into a single bin of the filter or is not scored at all. The filters of a tally
+/// compose, the tally keeps its scores for every combination of their bins. A filter may be used
+/// by several tallies, the bin of a step is then found once and shared by all of them.
+struct tally_filter {
+    std::string id;        ///< the user supplied id of the filter
+    filter_type type;      ///< the filtered quantity
+    std::size_t slot;      ///< index of the bin of the filter among the bins shared by the tallies
+    std::size_t bin_count; ///< the number of bins
+
+    /// Increasing bin edges of the energy and generation filters, bin i is [edges[i], edges[i+1])
+    std::vector<double> edges;
+
+    /// Bin of each interaction type of the interaction filter and of each object index of the
+    /// object and material filters, -1 if not scored
+    std::vector<int> bins;
+
+    /// Find the bin of a step
+    /// @param step the step to evaluate
+    /// @return the bin of the step, -1 if the step is not scored
+    int find_bin(const particle_step &step) const;
+};
+
+} // namespace projector
@@ -0,0 +1,151 @@
+#pragma once
+#include "constants.hpp"
+#include "geometry.hpp"
+#include "particle.hpp"
+#include "surface_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace projector {
+
+/// Part of a particle track inside of a single mesh cell
+struct track_cell {
+    std::size_t cell; ///< index of the cell
+    double length;    ///< track length inside of the cell
+};
+
+/// A step with its mesh lookups, shared by all tallies on the same mesh
+struct mesh_step {
+    const particle_step &step;
+    std::span<const track_cell> track;           ///< cells crossed by the step, if looked up
+    std::optional<std::size_t> interaction_cell; ///< cell of the end point, if looked up
+    std::span<const int> filter_bins;            ///< bin of the step in each filter, by its slot
+};
+
+/// Uniform grid of cells dividing a box, shared by the mesh tallies.
+///
+/// Cell x,y,z has index c = z * (resolution.x() * resolution.y()) + y * resolution.x() + x
+struct uniform_mesh {
+    bounding_box bounds; ///< the bounds of the mesh
+    coord3 resolution;   ///< resolution for each axis
+
+    std::size_t cell_count() const { return resolution.prod(); }
+
+    double cell_volume() const { return (bounds.max - bounds.min).prod() / resolution.prod(); }
+
+    /// Determine cell coordinates of a point
+    /// @param point the point to evaluate
+    /// @return returns empty if point is outside the grid, otherwise returns coordinates
+    std::optional<coord3> determine_cell(const vec3 &point) const;
+
+    /// Calculate the cell index for given coordinate
+    /// @param c the coordinate to evaluate
+    std::size_t calculate_index(const coord3 &c) const;
+
+    /// Walk the cells crossed by a segment, with the Amanatides-Woo traversal.
+    /// @param start start point of the segment
+    /// @param end end point of the segment
+    /// @param visit called with the index of each crossed cell and the track length inside of it
+    template <typename F>
+    void traverse(const vec3 &start, const vec3 &end, F &&visit) const;
+
+    /// Look up the cells of a step
+    /// @param step the step to look up
+    /// @param tracks whether to traverse the cells crossed by the step
+    /// @param interactions whether to find the cell of the end point of the step
+    /// @param track buffer for the crossed cells, the result refers to it
+    mesh_step lookup(const particle_step &step, bool tracks, bool interactions,
+                     std::vector<track_cell> &track) const;
+
+    bool operator==(const uniform_mesh &other) const {
+        return bounds.min == other.bounds.min && bounds.max == other.bounds.max &&
+               resolution == other.resolution;
+    }
+};
+
+template <typename F>
+void uniform_mesh::traverse(const vec3 &start, const vec3 &end, F &&visit) const {
+
+    // the direction is not normalized, so the segment is the [0, 1] range of the ray
+    vec3 dir = end - start;
+    double length = dir.norm();
+
+    if (length == 0.0) {
+        return;
+    }
+
+    auto [entry, exit] = slab_intersect(bounds.min, bounds.max, start, dir.cwiseInverse());
+
+    double t = std::max(entry, 0.0);
+    double t_end = std::min(exit, 1.0);
+
+    if (!(t < t_end)) {
+        return;
+    }
+
+    // t_max is the ray parameter of the next cell boundary on each axis and t_delta the parameter
+    // distance between the boundaries
+    vec3 entry_point = start + t * dir;
+
+    coord3 cell;
+    coord3 cell_step;
+    vec3 t_max;
+    vec3 t_delta;
+
+    for (int i = 0; i < 3; ++i) {
+        double cell_size = (bounds.max[i] - bounds.min[i]) / resolution[i];
+
+        // the entry point can be rounded just outside of the grid
+        int c = static_cast<int>(std::floor((entry_point[i] - bounds.min[i]) / cell_size));
+        cell[i] = std::clamp(c, 0, resolution[i] - 1);
+
+        if (dir[i] > 0.0) {
+            cell_step[i] = 1;
+            t_max[i] = (bounds.min[i] + (cell[i] + 1) * cell_size - start[i]) / dir[i];
+            t_delta[i] = cell_size / dir[i];
+        } else if (dir[i] < 0.0) {
+            cell_step[i] = -1;
+            t_max[i] = (bounds.min[i] + cell[i] * cell_size - start[i]) / dir[i];
+            t_delta[i] = -cell_size / dir[i];
+        } else {
+            cell_step[i] = 0;
+            t_max[i] = constants::infinity;
+            t_delta[i] = constants::infinity;
+        }
+    }
+
+    while (true) {
+        int axis = 0;
+        if (t_max[1] < t_max[axis]) {
+            axis = 1;
+        }
+        if (t_max[2] < t_max[axis]) {
+            axis = 2;
+        }
+
+        double t_next = std::min(t_max[axis], t_end);
+
+        if (t_next > t) {
+            visit(calculate_index(cell), (t_next - t) * length);
+        }
+
+        if (t_next >= t_end) {
+            break;
+        }
+
+        cell[axis] += cell_step[axis];
+
+        if (cell[axis] < 0 || cell[axis] >= resolution[axis]) {
+            break;
+        }
+
+        t = t_next;
+        t_max[axis] += t_delta[axis];
+    }
+}
+
+} // namespace projector
@@ -1,9 +1,16 @@
+#include "mapped_file.hpp"
 #include "material.hpp"
 
+#include <charconv>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <map>
+#include <memory>
 #include <stdexcept>
+#include <string>
 
 // This currently expects the exact format of eprdata14 files
 // It probably won't work on other data
@@ -11,59 +18,90 @@
 
 namespace {
 
-void ignore_lines(std::ifstream &file_stream, std::size_t lines) {
-    char temp[81];
+/// Reader of whitespace separated numbers from a text block
+class number_reader {
 
-    for (std::size_t i = 0; i < lines; ++i) {
-        file_stream.getline(temp, 81);
-    }
-}
+    const char *pos;
+    const char *end;
 
-template <typename T>
-void read_to_array(std::ifstream &src, T &dest, std::size_t count) {
-    for (std::size_t i = 0; i < count; ++i) {
-        src >> dest[i];
-    }
-}
+public:
+    explicit number_reader(std::string_view text) : pos(text.data()), end(pos + text.size()) {}
 
-// this should have a concept!!
-template <typename F>
-void read_map_insert(std::ifstream &src, std::vector<double> &dest,
-                     std::size_t count, F map_func) {
-    for (std::size_t i = 0; i < count; ++i) {
-        double val;
-        src >> val;
-        dest.push_back(map_func(val));
+    template <typename T>
+    T next() {
+        while (pos != end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+            ++pos;
+        }
+
+        T value;
+        auto [last, error] = std::from_chars(pos, end, value);
+
+        if (error != std::errc()) {
+            throw std::runtime_error("Invalid number in ACE data: " +
+                                     std::string(pos, std::min<std::ptrdiff_t>(end - pos, 20)));
+        }
+
+        pos = last;
+        return value;
+    }
+};
+
+/// Find the byte offsets of the starts of lines in a text.
+/// @param lines sorted line numbers, starting at 1
+std::vector<std::size_t> line_offsets(std::string_view text,
+                                      const std::vector<std::size_t> &lines) {
+
+    std::vector<std::size_t> offsets;
+    offsets.reserve(lines.size());
+
+    std::size_t line = 1;
+    std::size_t offset = 0;
+
+    for (std::size_t target : lines) {
+        while (line < target) {
+            const void *newline = std::memchr(text.data() + offset, '\n', text.size() - offset);
+            if (newline == nullptr) {
+                throw std::runtime_error("Line " + std::to_string(target) +
+                                         " is past the end of the file");
+            }
+            offset = static_cast<const char *>(newline) - text.data() + 1;
+            ++line;
+        }
+        offsets.push_back(offset);
     }
+
+    return offsets;
 }
 
 } // namespace
 
 namespace projector {
 
-element element::load_from_ace_file(std::filesystem::path input_file,
-                                    std::size_t line) {
-    auto file_stream = std::ifstream(input_file);
-    if (!file_stream.is_open()) {
-        throw std::runtime_error("Failed opening " + input_file.string());
-    }
+element element::load_from_ace_text(std::string_view text) {
 
-    // seek to line with first interesting data - first line of NXS block
-    ignore_lines(file_stream, line + 6);
-    if (!file_stream.good()) {
-        throw std::runtime_error("Error while seeking");
+    // skip the header to the first line of NXS block
+    for (std::size_t i = 0; i < 6; ++i) {
+        std::size_t newline = text.find('\n');
+        if (newline == std::string_view::npos) {
+            throw std::runtime_error("Error while seeking");
+        }
+        text.remove_prefix(newline + 1);
     }
 
-    std::string temp;
+    number_reader reader(text);
 
     std::array<std::size_t, 16> NXS;
     std::array<std::size_t, 32> JXS;
 
-    read_to_array(file_stream, NXS, 16);
-    read_to_array(file_stream, JXS, 32);
-
-    if (!file_stream.good()) {
-        throw std::runtime_error("Error while reading NXS/JXS data");
+    try {
+        for (std::size_t &value : NXS) {
+            value = reader.next<std::size_t>();
+        }
+        for (std::size_t &value : JXS) {
+            value = reader.next<std::size_t>();
+        }
+    } catch (...) {
+        std::throw_with_nested(std::runtime_error("Error while reading NXS/JXS data"));
     }
 
     std::size_t N_y = NXS[2];
@@ -73,32 +111,48 @@ element element::load_from_ace_file(std::filesystem::path input_file,
     element elem;
     elem.atomic_number = NXS[1];
 
-    auto unlog = [](double val) {
-        if (val == 0.0) {
-            return 0.0;
-        }
-        return std::exp(val);
-    };
-
-    auto no_op = [](double val) { return val; };
+    // all the tables are stored in one block, in the order of the file
+    auto data = std::make_shared<std::vector<double>>(5 * N_y + 2 * N_inc + 3 * N_coh);
+    double *table = data->data();
 
     try {
-        for (std::size_t i = 0; i < 5; ++i) {
-            read_map_insert(file_stream, elem.xs_data[i], N_y, unlog);
-        }
-        for (std::size_t i = 0; i < 2; ++i) {
-            read_map_insert(file_stream, elem.ff_data[i], N_inc, no_op);
+        // the cross section tables are logarithms
+        for (std::size_t i = 0; i < 5 * N_y; ++i) {
+            double value = reader.next<double>();
+            table[i] = value == 0.0 ? 0.0 : std::exp(value);
         }
-        for (std::size_t i = 0; i < 3; ++i) {
-            read_map_insert(file_stream, elem.ff_data[i + 2], N_coh, no_op);
+        for (std::size_t i = 5 * N_y; i < data->size(); ++i) {
+            table[i] = reader.next<double>();
         }
     } catch (...) {
-        std::throw_with_nested("Error while reading main data block");
+        std::throw_with_nested(std::runtime_error("Error while reading main data block"));
     }
 
+    for (std::size_t i = 0; i < 5; ++i, table += N_y) {
+        elem.xs_data[i] = {table, N_y};
+    }
+    for (std::size_t i = 0; i < 2; ++i, table += N_inc) {
+        elem.ff_data[i] = {table, N_inc};
+    }
+    for (std::size_t i = 0; i < 3; ++i, table += N_coh) {
+        elem.ff_data[i + 2] = {table, N_coh};
+    }
+
+    elem.storage = std::move(data);
+
     return elem;
 }
 
+element element::load_from_ace_file(std::filesystem::path input_file, std::streamoff offset) {
+    mapped_file file(input_file);
+
+    if (offset < 0 || static_cast<std::size_t>(offset) >= file.size()) {
+        throw std::runtime_error("Offset is past the end of " + input_file.string());
+    }
+
+    return load_from_ace_text(file.text().substr(offset));
+}
+
 data_library data_library::load_ace_data(std::filesystem::path xsdir_file) {
 
     auto xsdir_stream = std::ifstream(xsdir_file);
@@ -127,28 +181,93 @@ data_library data_library::load_ace_data(std::filesystem::path xsdir_file) {
             throw std::runtime_error("Error while parsing xsdir line: " + line);
         }
 
+        data.locations[i] = {xsdir_file.parent_path() / ace_path_str, start_line};
+
+        data.elements[i].atomic_number = i + 1;
+        data.elements[i].atomic_weight = weight;
+    }
+
+    xsdir_stream.close();
+
+    return data;
+}
+
+void data_library::load_elements(const std::vector<material_data> &materials) {
+
+    // missing elements, grouped by file and sorted by line
+    std::map<std::filesystem::path, std::map<std::size_t, std::size_t>> missing;
+
+    for (const auto &mat : materials) {
+        for (std::size_t atomic_number : mat.elements) {
+            if (atomic_number < 1 || atomic_number > elements.size()) {
+                throw std::runtime_error("Invalid atomic number " + std::to_string(atomic_number));
+            }
+            if (!elements[atomic_number - 1].loaded()) {
+                const ace_location &location = locations[atomic_number - 1];
+                missing[location.path][location.line] = atomic_number - 1;
+            }
+        }
+    }
+
+    // each file is mapped once, the tables are parsed directly from the mapping
+    struct table_text {
+        std::size_t index;
+        std::string_view text;
+    };
+
+    std::vector<std::unique_ptr<mapped_file>> files;
+    std::vector<table_text> tables;
 
-        element elem;
-        std::filesystem::path ace_path(ace_path_str);
-        ace_path = xsdir_file.parent_path() / ace_path;
+    for (const auto &[path, file_tables] : missing) {
+        std::vector<std::size_t> lines;
+        for (auto [line, index] : file_tables) {
+            lines.push_back(line);
+        }
 
+        std::vector<std::size_t> offsets;
         try {
-            elem = element::load_from_ace_file(ace_path, start_line - 1);
+            files.push_back(std::make_unique<mapped_file>(path));
+            offsets = line_offsets(files.back()->text(), lines);
         } catch (...) {
-            std::throw_with_nested(std::runtime_error(
-                "Error while reading ACE file: " + ace_path.string()));
+            std::throw_with_nested(
+                std::runtime_error("Error while indexing ACE file: " + path.string()));
         }
 
+        std::size_t k = 0;
+        for (auto [line, index] : file_tables) {
+            tables.push_back({index, files.back()->text().substr(offsets[k++])});
+        }
+    }
 
-        elem.atomic_number = i + 1;
-        elem.atomic_weight = weight;
+    std::vector<std::exception_ptr> errors(tables.size());
 
-        data.elements[i] = elem;
-    }
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t k = 0; k < tables.size(); ++k) {
+        auto [index, text] = tables[k];
 
-    xsdir_stream.close();
+        try {
+            try {
+                element elem = element::load_from_ace_text(text);
+
+                elem.atomic_number = elements[index].atomic_number;
+                elem.atomic_weight = elements[index].atomic_weight;
+                elem.set_grid_search(search_method);
+
+                elements[index] = std::move(elem);
+            } catch (...) {
+                std::throw_with_nested(std::runtime_error("Error while reading ACE file: " +
+                                                          locations[index].path.string()));
+            }
+        } catch (...) {
+            errors[k] = std::current_exception();
+        }
+    }
 
-    return data;
+    for (const auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
 }
 
-} // namespace projector
\ No newline at end of file
+} // namespace projector
@@ -0,0 +1,249 @@
+#include "mapped_file.hpp"
+#include "material.hpp"
+
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+// Binary cache of the ACE library - the processed tables (unlogged cross sections and form
+// factors) of all elements, in native byte order. The file starts with a header and a table of
+// the elements, the data tables follow, each aligned to 64 bytes.
+
+namespace {
+
+using projector::mapped_file;
+
+/// Version of the cache layout, must be increased whenever the layout or processing changes
+constexpr uint32_t cache_version = 1;
+
+constexpr char cache_magic[8] = {'P', 'R', 'J', 'X', 'S', 'B', 'I', 'N'};
+
+constexpr uint64_t table_alignment = 64;
+
+/// Tables of each element, the 5 cross section tables followed by the 5 form factor tables
+constexpr std::size_t table_count = 10;
+
+constexpr std::size_t element_count = 100;
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t element_count;
+    uint64_t fingerprint; ///< fingerprint of the source files
+};
+
+struct cache_entry {
+    double atomic_weight;
+    std::array<uint64_t, table_count> offset; ///< byte offsets of the tables in the file
+    std::array<uint64_t, table_count> count;  ///< value counts of the tables
+};
+
+uint64_t align(uint64_t position) {
+    return (position + table_alignment - 1) / table_alignment * table_alignment;
+}
+
+uint64_t fnv1a(uint64_t hash, const void *data, std::size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+/// Fingerprint of the library sources - the content of the xsdir file and the sizes and
+/// modification times of the ACE files
+uint64_t source_fingerprint(const std::filesystem::path &xsdir_path,
+                            const std::array<projector::ace_location, element_count> &locations) {
+    std::ifstream xsdir_stream(xsdir_path, std::ios::binary);
+    std::string xsdir((std::istreambuf_iterator<char>(xsdir_stream)),
+                      std::istreambuf_iterator<char>());
+
+    uint64_t hash = fnv1a(14695981039346656037ull, xsdir.data(), xsdir.size());
+
+    std::set<std::filesystem::path> ace_files;
+    for (const auto &location : locations) {
+        ace_files.insert(location.path);
+    }
+
+    for (const auto &path : ace_files) {
+        uint64_t size = std::filesystem::file_size(path);
+        int64_t time = std::filesystem::last_write_time(path).time_since_epoch().count();
+
+        hash = fnv1a(hash, &size, sizeof(size));
+        hash = fnv1a(hash, &time, sizeof(time));
+    }
+
+    return hash;
+}
+
+/// Check the header of a mapped cache file and that all of its tables are inside of the file
+bool valid_cache(const mapped_file &file, uint64_t fingerprint) {
+    if (file.size() < sizeof(cache_header) + element_count * sizeof(cache_entry)) {
+        return false;
+    }
+
+    cache_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.version != cache_version || header.element_count != element_count ||
+        header.fingerprint != fingerprint) {
+        return false;
+    }
+
+    // a truncated file is missing some of the tables
+    for (std::size_t i = 0; i < element_count; ++i) {
+        cache_entry entry;
+        std::memcpy(&entry, file.data() + sizeof(cache_header) + i * sizeof(cache_entry),
+                    sizeof(entry));
+
+        for (std::size_t k = 0; k < table_count; ++k) {
+            if (entry.offset[k] % table_alignment != 0 ||
+                entry.offset[k] + entry.count[k] * sizeof(double) > file.size()) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+namespace projector {
+
+void data_library::write_binary_data(std::filesystem::path xsdir_path,
+                                     std::filesystem::path cache_path) {
+
+    data_library data = load_ace_data(xsdir_path);
+
+    material_data all_elements;
+    for (std::size_t i = 1; i <= element_count; ++i) {
+        all_elements.elements.push_back(i);
+    }
+    data.load_elements({all_elements});
+
+    cache_header header;
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.element_count = element_count;
+    header.fingerprint = source_fingerprint(xsdir_path, data.locations);
+
+    // layout of the tables
+    std::vector<cache_entry> entries(element_count);
+    std::vector<std::span<const double>> tables;
+
+    uint64_t position = align(sizeof(header) + element_count * sizeof(cache_entry));
+
+    for (std::size_t i = 0; i < element_count; ++i) {
+        const element &elem = data.elements[i];
+        entries[i].atomic_weight = elem.atomic_weight;
+
+        for (std::size_t k = 0; k < table_count; ++k) {
+            std::span<const double> table = k < 5 ? elem.xs_data[k] : elem.ff_data[k - 5];
+
+            entries[i].offset[k] = position;
+            entries[i].count[k] = table.size();
+            tables.push_back(table);
+
+            position = align(position + table.size_bytes());
+        }
+    }
+
+    // written to a temporary file first, so that concurrent runs never see a partial cache
+    std::filesystem::path temp_path = cache_path;
+    temp_path += ".tmp" + std::to_string(getpid());
+
+    std::ofstream out(temp_path, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed opening " + temp_path.string());
+    }
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(cache_entry));
+
+    std::size_t k = 0;
+    for (const auto &entry : entries) {
+        for (uint64_t offset : entry.offset) {
+            std::span<const double> table = tables[k++];
+
+            std::size_t padding = offset - static_cast<uint64_t>(out.tellp());
+            out.write(std::string(padding, '\0').data(), padding);
+            out.write(reinterpret_cast<const char *>(table.data()), table.size_bytes());
+        }
+    }
+
+    out.close();
+
+    if (!out) {
+        std::filesystem::remove(temp_path);
+        throw std::runtime_error("Error while writing " + temp_path.string());
+    }
+
+    std::filesystem::rename(temp_path, cache_path);
+}
+
+data_library data_library::load_binary_data(std::filesystem::path xsdir_path,
+                                            std::filesystem::path cache_path) {
+
+    data_library data = load_ace_data(xsdir_path);
+
+    uint64_t fingerprint = source_fingerprint(xsdir_path, data.locations);
+
+    std::shared_ptr<const mapped_file> file;
+
+    // an empty or unreadable cache is rebuilt like any other invalid cache
+    if (std::filesystem::exists(cache_path) && std::filesystem::file_size(cache_path) > 0) {
+        try {
+            file = std::make_shared<const mapped_file>(cache_path);
+        } catch (const std::runtime_error &) {
+            file.reset();
+        }
+    }
+
+    if (!file || !valid_cache(*file, fingerprint)) {
+        file.reset();
+        write_binary_data(xsdir_path, cache_path);
+        file = std::make_shared<const mapped_file>(cache_path);
+
+        if (!valid_cache(*file, fingerprint)) {
+            throw std::runtime_error("Invalid binary cache " + cache_path.string());
+        }
+    }
+
+    for (std::size_t i = 0; i < element_count; ++i) {
+        cache_entry entry;
+        std::memcpy(&entry, file->data() + sizeof(cache_header) + i * sizeof(cache_entry),
+                    sizeof(entry));
+
+        element &elem = data.elements[i];
+        elem.atomic_weight = entry.atomic_weight;
+
+        // the table bounds were checked by valid_cache
+        for (std::size_t k = 0; k < table_count; ++k) {
+            std::span<const double> table(
+                reinterpret_cast<const double *>(file->data() + entry.offset[k]), entry.count[k]);
+
+            if (k < 5) {
+                elem.xs_data[k] = table;
+            } else {
+                elem.ff_data[k - 5] = table;
+            }
+        }
+
+        elem.storage = file;
+    }
+
+    return data;
+}
+
+} // namespace projector
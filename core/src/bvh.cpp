@@ -0,0 +1,126 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// max items in a leaf node
+constexpr std::size_t leaf_size = 2;
+
+} // namespace
+
+namespace projector {
+
+void bvh::build(const std::vector<bounding_box> &item_boxes) {
+
+    boxes = item_boxes;
+    nodes.clear();
+    items.resize(boxes.size());
+    std::iota(items.begin(), items.end(), 0);
+
+    if (boxes.empty()) {
+        return;
+    }
+
+    nodes.reserve(2 * boxes.size());
+    build_node(0, items.size());
+}
+
+std::size_t bvh::build_node(std::size_t first, std::size_t count) {
+
+    std::size_t current = nodes.size();
+    nodes.emplace_back();
+
+    bounding_box box = boxes[items[first]];
+    vec3 centroid_min = (box.min + box.max) / 2.0;
+    vec3 centroid_max = centroid_min;
+    std::size_t max_index = items[first];
+
+    for (std::size_t i = first; i < first + count; ++i) {
+        const bounding_box &item = boxes[items[i]];
+        vec3 centroid = (item.min + item.max) / 2.0;
+
+        box.min = box.min.cwiseMin(item.min);
+        box.max = box.max.cwiseMax(item.max);
+        centroid_min = centroid_min.cwiseMin(centroid);
+        centroid_max = centroid_max.cwiseMax(centroid);
+        max_index = std::max(max_index, items[i]);
+    }
+
+    nodes[current].box = box;
+    nodes[current].max_index = max_index;
+
+    if (count <= leaf_size) {
+        nodes[current].first = first;
+        nodes[current].count = count;
+        return current;
+    }
+
+    // median split along the longest axis of the centroids
+    std::size_t axis = 0;
+    (centroid_max - centroid_min).maxCoeff(&axis);
+
+    auto begin = items.begin() + first;
+    auto middle = begin + count / 2;
+
+    std::nth_element(begin, middle, begin + count, [this, axis](std::size_t a, std::size_t b) {
+        return boxes[a].min[axis] + boxes[a].max[axis] < boxes[b].min[axis] + boxes[b].max[axis];
+    });
+
+    build_node(first, count / 2);
+    std::size_t right = build_node(first + count / 2, count - count / 2);
+
+    nodes[current].right = right;
+    nodes[current].count = 0;
+
+    return current;
+}
+
+void bvh::find_overlapping(const bounding_box &query, std::vector<std::size_t> &found) const {
+
+    found.clear();
+
+    if (nodes.empty()) {
+        return;
+    }
+
+    auto overlaps = [&query](const bounding_box &box) {
+        for (std::size_t i = 0; i < 3; ++i) {
+            if (query.max[i] < box.min[i] || query.min[i] > box.max[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::array<std::size_t, stack_size> stack;
+    std::size_t stack_top = 0;
+    stack[stack_top++] = 0;
+
+    while (stack_top > 0) {
+        std::size_t current = stack[--stack_top];
+        const node &n = nodes[current];
+
+        if (!overlaps(n.box)) {
+            continue;
+        }
+
+        if (n.count == 0) {
+            stack[stack_top++] = n.right;
+            stack[stack_top++] = current + 1;
+            continue;
+        }
+
+        for (std::size_t i = n.first; i < n.first + n.count; ++i) {
+            if (overlaps(boxes[items[i]])) {
+                found.push_back(items[i]);
+            }
+        }
+    }
+
+    // the callers keep the priority of the later items
+    std::sort(found.begin(), found.end());
+}
+
+} // namespace projector
@@ -0,0 +1,191 @@
+#include "csg_program.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace projector {
+
+void csg_program::add_plane(const plane_coeffs &plane) {
+    code.push_back({csg_opcode::plane, static_cast<uint32_t>(planes.size())});
+    planes.push_back(plane);
+}
+
+void csg_program::add_axis_quadric(const axis_quadric_coeffs &quadric) {
+    code.push_back({csg_opcode::axis_quadric, static_cast<uint32_t>(axis_quadrics.size())});
+    axis_quadrics.push_back(quadric);
+}
+
+void csg_program::add_quadric(const quadric_coeffs &quadric) {
+    code.push_back({csg_opcode::quadric, static_cast<uint32_t>(quadrics.size())});
+    quadrics.push_back(quadric);
+}
+
+void csg_program::add_box(const vec3 &min, const vec3 &max) {
+    code.push_back({csg_opcode::box, static_cast<uint32_t>(boxes.size())});
+    boxes.push_back(min, max);
+}
+
+void csg_program::add_operation(csg_opcode op) { code.push_back({op, 0}); }
+
+void csg_program::validate() const {
+    std::size_t depth = 0;
+
+    for (auto &instruction : code) {
+        switch (instruction.code) {
+        case csg_opcode::push_true:
+        case csg_opcode::plane:
+        case csg_opcode::axis_quadric:
+        case csg_opcode::quadric:
+        case csg_opcode::box:
+            depth++;
+            break;
+        default:
+            if (depth < 2) {
+                throw std::runtime_error("invalid CSG program, stack underflow");
+            }
+            depth--;
+            break;
+        }
+
+        if (depth > max_depth) {
+            throw std::runtime_error("geometry is nested too deep");
+        }
+    }
+
+    if (depth != 1) {
+        throw std::runtime_error("invalid CSG program, wrong final stack size");
+    }
+}
+
+bool csg_program::point_inside(const vec3 &point) const {
+
+    // stack of booleans, top is the lowest bit
+    uint64_t stack = 0;
+
+    for (auto &instruction : code) {
+        uint64_t value;
+
+        switch (instruction.code) {
+        case csg_opcode::push_true:
+            stack = (stack << 1) | 1u;
+            break;
+        case csg_opcode::plane:
+            stack = (stack << 1) | plane_inside(planes, instruction.index, point);
+            break;
+        case csg_opcode::axis_quadric:
+            stack = (stack << 1) | axis_quadric_inside(axis_quadrics, instruction.index, point);
+            break;
+        case csg_opcode::quadric:
+            stack = (stack << 1) | quadric_inside(quadrics, instruction.index, point);
+            break;
+        case csg_opcode::box:
+            stack = (stack << 1) | box_inside(boxes, instruction.index, point);
+            break;
+        case csg_opcode::join:
+            value = stack & 1u;
+            stack = (stack >> 1) | value;
+            break;
+        case csg_opcode::intersect:
+            value = stack & 1u;
+            stack = (stack >> 1) & (~uint64_t{1} | value);
+            break;
+        case csg_opcode::substract:
+            value = stack & 1u;
+            stack = (stack >> 1) & ~value;
+            break;
+        }
+    }
+
+    return stack & 1u;
+}
+
+double csg_program::nearest_surface_distance(const vec3 &point, const vec3 &dir) const {
+
+    // the surfaces of the geometry do not depend on the operations, check them all
+    return std::min({nearest_plane_distance(planes, point, dir),
+                     nearest_axis_quadric_distance(axis_quadrics, point, dir),
+                     nearest_quadric_distance(quadrics, point, dir),
+                     nearest_box_distance(boxes, point, dir)});
+}
+
+void csg_program::points_inside(const ray_packet &points, uint8_t *inside) const {
+
+    // same evaluation as the single point version, each lane has its own stack
+    std::array<uint64_t, packet_width> stack;
+    std::array<uint8_t, packet_width> value;
+
+    for (std::size_t first = 0; first < points.size; first += packet_width) {
+        ray_packet packet = points.slice(first, std::min(packet_width, points.size - first));
+        std::size_t size = packet.size;
+
+        stack.fill(0);
+
+        for (auto &instruction : code) {
+            switch (instruction.code) {
+            case csg_opcode::push_true:
+                value.fill(1);
+                break;
+            case csg_opcode::plane:
+                plane_inside(planes, instruction.index, packet, value.data());
+                break;
+            case csg_opcode::axis_quadric:
+                axis_quadric_inside(axis_quadrics, instruction.index, packet, value.data());
+                break;
+            case csg_opcode::quadric:
+                quadric_inside(quadrics, instruction.index, packet, value.data());
+                break;
+            case csg_opcode::box:
+                box_inside(boxes, instruction.index, packet, value.data());
+                break;
+            case csg_opcode::join:
+                for (std::size_t j = 0; j < size; ++j) {
+                    stack[j] = (stack[j] >> 1) | (stack[j] & 1u);
+                }
+                continue;
+            case csg_opcode::intersect:
+                for (std::size_t j = 0; j < size; ++j) {
+                    stack[j] = (stack[j] >> 1) & (~uint64_t{1} | (stack[j] & 1u));
+                }
+                continue;
+            case csg_opcode::substract:
+                for (std::size_t j = 0; j < size; ++j) {
+                    stack[j] = (stack[j] >> 1) & ~(stack[j] & 1u);
+                }
+                continue;
+            }
+
+            // push the value of the operand
+            for (std::size_t j = 0; j < size; ++j) {
+                stack[j] = (stack[j] << 1) | value[j];
+            }
+        }
+
+        for (std::size_t j = 0; j < size; ++j) {
+            inside[first + j] = stack[j] & 1u;
+        }
+    }
+}
+
+void csg_program::nearest_surface_distances(const ray_packet &rays, double *distances) const {
+
+    std::fill(distances, distances + rays.size, constants::infinity);
+
+    for (std::size_t i = 0; i < planes.size(); ++i) {
+        nearest_plane_distance(planes, i, rays, distances);
+    }
+
+    for (std::size_t i = 0; i < axis_quadrics.size(); ++i) {
+        nearest_axis_quadric_distance(axis_quadrics, i, rays, distances);
+    }
+
+    for (std::size_t i = 0; i < quadrics.size(); ++i) {
+        nearest_quadric_distance(quadrics, i, rays, distances);
+    }
+
+    for (std::size_t i = 0; i < boxes.size(); ++i) {
+        nearest_box_distance(boxes, i, rays, distances);
+    }
+}
+
+} // namespace projector
@@ -1,5 +1,8 @@
 #include "environment.hpp"
 
+#include "constants.hpp"
+
+#include <algorithm>
 #include <fstream>
 
 
@@ -32,4 +35,93 @@ void particle::save_particle(const std::filesystem::path path) const {
     output_file.close();
 }
 
+void environment::build_object_tree() {
+
+    std::vector<bounding_box> boxes;
+
+    // nothing outside of the environment bounds is simulated, so clip the boxes by it
+    for (const auto &obj : objects) {
+        boxes.push_back(
+            {obj.geom.bb.min.cwiseMax(bounds.min), obj.geom.bb.max.cwiseMin(bounds.max)});
+    }
+
+    object_tree.build(boxes);
+}
+
+const object *environment::find_object(const vec3 &point) const {
+
+    // objects defined later take priority
+    auto found = object_tree.find_last(point, [this, &point](std::size_t index) {
+        return objects[index].geom.point_inside(point);
+    });
+
+    return found ? &objects[*found] : nullptr;
+}
+
+void environment::find_objects(const ray_packet &points, const object **found,
+                               object_lookup_scratch &scratch) const {
+
+    std::fill(found, found + points.size, nullptr);
+
+    if (points.size == 0) {
+        return;
+    }
+
+    // bounds of the packet, to select the candidate objects from the hierarchy
+    bounding_box packet_bounds = {{points.x[0], points.y[0], points.z[0]},
+                                  {points.x[0], points.y[0], points.z[0]}};
+    for (std::size_t j = 1; j < points.size; ++j) {
+        vec3 point = {points.x[j], points.y[j], points.z[j]};
+        packet_bounds.min = packet_bounds.min.cwiseMin(point);
+        packet_bounds.max = packet_bounds.max.cwiseMax(point);
+    }
+
+    object_tree.find_overlapping(packet_bounds, scratch.candidates);
+
+    scratch.inside.resize(points.size);
+    scratch.in_geometry.resize(points.size);
+    uint8_t *inside = scratch.inside.data();
+    uint8_t *in_geometry = scratch.in_geometry.data();
+
+    // objects defined later take priority, so the last object containing the point is kept
+    for (std::size_t index : scratch.candidates) {
+        const bounding_box &box = object_tree.box(index);
+
+        bool any_in_box = false;
+        for (std::size_t j = 0; j < points.size; ++j) {
+            inside[j] = points.x[j] >= box.min.x() && points.x[j] <= box.max.x() &&
+                        points.y[j] >= box.min.y() && points.y[j] <= box.max.y() &&
+                        points.z[j] >= box.min.z() && points.z[j] <= box.max.z();
+            any_in_box = any_in_box || inside[j];
+        }
+
+        if (!any_in_box) {
+            continue;
+        }
+
+        objects[index].geom.points_inside(points, in_geometry);
+
+        for (std::size_t j = 0; j < points.size; ++j) {
+            if (inside[j] && in_geometry[j]) {
+                found[j] = &objects[index];
+            }
+        }
+    }
+}
+
+double environment::nearest_object_distance(const vec3 &point, const vec3 &dir) const {
+
+    // nearest surfaces of all objects whose bounding box is hit
+    double surface_distance =
+        object_tree.nearest(point, dir, [this, &point, &dir](std::size_t index) {
+            return objects[index].geom.nearest_surface_distance(point, dir);
+        });
+
+    if (surface_distance == constants::infinity) {
+        return bounds.distance_along_line(point, dir);
+    }
+
+    return surface_distance;
+}
+
 } // namespace projector
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "constants.hpp"
+#include "random_numbers.hpp"
+#include "runtime.hpp"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+namespace {
+
+using projector::vec3;
+
+/// The event at the end of the current step of a banked particle
+enum class event { none, collision, crossing, leave };
+
+/// Structure of arrays bank of particles processed by the event engine.
+struct particle_bank {
+    // particle state
+    std::vector<double> x, y, z;
+    std::vector<double> u, v, w;
+    std::vector<double> energy;
+    std::vector<uint64_t> prng_state;
+    std::vector<const projector::object *> object;
+    std::vector<std::size_t> generation;
+
+    // state at the start of the current step
+    std::vector<double> start_x, start_y, start_z;
+    std::vector<double> start_energy;
+    std::vector<std::size_t> start_object;
+
+    // data of the current step
+    std::vector<double> macro_xs;
+    std::vector<const projector::element *> elem;
+    std::vector<projector::sampled_xs> elem_xs;
+    std::vector<double> distance;
+    std::vector<event> next_event;
+    std::vector<projector::cross_section> interaction;
+
+    explicit particle_bank(std::size_t count) {
+        for (auto *vec : {&x, &y, &z, &u, &v, &w, &energy, &start_x, &start_y, &start_z,
+                          &start_energy, &macro_xs, &distance}) {
+            vec->resize(count);
+        }
+        prng_state.resize(count);
+        object.resize(count, nullptr);
+        generation.resize(count, 0);
+        start_object.resize(count, projector::no_object);
+        elem.resize(count, nullptr);
+        elem_xs.resize(count);
+        next_event.resize(count, event::none);
+        interaction.resize(count, projector::cross_section::no_interaction);
+    }
+
+    void load(std::size_t i, const projector::particle &p) {
+        const vec3 &pos = p.history.points.back();
+
+        x[i] = pos.x();
+        y[i] = pos.y();
+        z[i] = pos.z();
+        u[i] = p.direction.x();
+        v[i] = p.direction.y();
+        w[i] = p.direction.z();
+        energy[i] = p.history.energies.back();
+        prng_state[i] = p.prng_state;
+        generation[i] = 0;
+    }
+
+    vec3 position(std::size_t i) const { return {x[i], y[i], z[i]}; }
+
+    vec3 direction(std::size_t i) const { return {u[i], v[i], w[i]}; }
+
+    void advance(std::size_t i, double dist) {
+        x[i] += dist * u[i];
+        y[i] += dist * v[i];
+        z[i] += dist * w[i];
+    }
+
+    projector::particle_step step(std::size_t i) const {
+        return {.start = {start_x[i], start_y[i], start_z[i]},
+                .end = position(i),
+                .energy = start_energy[i],
+                .end_energy = energy[i],
+                .interaction = interaction[i],
+                .element = elem[i] == nullptr ? 0 : elem[i]->atomic_number,
+                .object = start_object[i],
+                .generation = generation[i]};
+    }
+};
+
+/// Particles evaluated together by the packet kernels
+constexpr std::size_t packet_width = 64;
+
+/// Sort the queue of particles by a key, so that particles with the same key are processed
+/// together.
+template <typename F>
+void sort_queue(std::vector<std::size_t> &queue, F key) {
+    std::stable_sort(queue.begin(), queue.end(),
+                     [&key](std::size_t a, std::size_t b) { return key(a) < key(b); });
+}
+
+} // namespace
+
+namespace projector {
+
+namespace {
+
+/// Transport a pass of the current batch, the particles first to first + count
+void transport_events(environment &env, std::size_t first, std::size_t count) {
+
+    particle_bank bank(count);
+
+    std::vector<std::size_t> alive(count);
+    std::iota(alive.begin(), alive.end(), 0);
+
+    std::vector<std::size_t> void_queue;
+    std::vector<std::size_t> lookup_queue;
+    std::vector<std::size_t> collision_queue;
+    std::vector<std::size_t> crossing_queue;
+
+    // packets of the lookup queue, given by the first queue position and size
+    struct packet {
+        std::size_t first;
+        std::size_t size;
+    };
+    std::vector<packet> packets;
+
+    // sample the source particles into the bank and locate them
+    #pragma omp parallel
+    {
+        particle p;
+
+        #pragma omp for
+        for (std::size_t i = 0; i < count; ++i) {
+            sample_source_particle(env, env.batch_start + first + i, p);
+
+            bank.load(i, p);
+            bank.object[i] = env.find_object(bank.position(i));
+
+            if (env.save_particle_paths) {
+                env.particles[first + i] = p;
+            }
+        }
+    }
+
+    for (std::size_t iteration = 0; iteration < env.stack_size && !alive.empty(); ++iteration) {
+
+        // remove finished particles - energy cutoff or out of bounds
+        std::erase_if(alive, [&](std::size_t i) {
+            return bank.energy[i] <= env.energy_cutoff ||
+                   !env.bounds.point_inside(bank.position(i));
+        });
+
+        void_queue.clear();
+        lookup_queue.clear();
+
+        for (std::size_t i : alive) {
+            bank.start_x[i] = bank.x[i];
+            bank.start_y[i] = bank.y[i];
+            bank.start_z[i] = bank.z[i];
+            bank.start_energy[i] = bank.energy[i];
+            bank.start_object[i] = env.object_index(bank.object[i]);
+            bank.interaction[i] = cross_section::no_interaction;
+            bank.elem[i] = nullptr;
+
+            if (bank.object[i] == nullptr) {
+                void_queue.push_back(i);
+            } else {
+                lookup_queue.push_back(i);
+            }
+        }
+
+        // particles in void - move to the nearest surface
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < void_queue.size(); ++q) {
+            std::size_t i = void_queue[q];
+
+            double dist = env.nearest_object_distance(bank.position(i), bank.direction(i));
+            bank.advance(i, dist + 5 * constants::epsilon);
+            bank.object[i] = env.find_object(bank.position(i));
+        }
+
+        // cross section lookup, grouped by material and object
+        sort_queue(lookup_queue, [&](std::size_t i) {
+            return std::make_pair(bank.object[i]->material_id, bank.object[i]);
+        });
+
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < lookup_queue.size(); ++q) {
+            std::size_t i = lookup_queue[q];
+
+            auto [material_total_macro_xs, elem, elem_xs] = env.cross_section_data.sample_material(
+                env.materials[bank.object[i]->material_id], bank.energy[i], bank.prng_state[i]);
+
+            bank.macro_xs[i] = material_total_macro_xs;
+            bank.elem[i] = elem;
+            bank.elem_xs[i] = elem_xs;
+        }
+
+        // surface distances, evaluated in packets of particles in the same object
+        packets.clear();
+        for (std::size_t q = 0; q < lookup_queue.size(); ++q) {
+            if (packets.empty() || packets.back().size == packet_width ||
+                bank.object[lookup_queue[q]] != bank.object[lookup_queue[packets.back().first]]) {
+                packets.push_back({q, 0});
+            }
+            packets.back().size++;
+        }
+
+        #pragma omp parallel for
+        for (std::size_t k = 0; k < packets.size(); ++k) {
+            auto [first, size] = packets[k];
+            std::array<double, packet_width> x, y, z, u, v, w, inv_u, inv_v, inv_w, distance;
+
+            for (std::size_t j = 0; j < size; ++j) {
+                std::size_t i = lookup_queue[first + j];
+                x[j] = bank.x[i];
+                y[j] = bank.y[i];
+                z[j] = bank.z[i];
+                u[j] = bank.u[i];
+                v[j] = bank.v[i];
+                w[j] = bank.w[i];
+            }
+
+            // the inverted directions are shared by all the boxes of the geometry
+            for (std::size_t j = 0; j < size; ++j) {
+                inv_u[j] = 1.0 / u[j];
+                inv_v[j] = 1.0 / v[j];
+                inv_w[j] = 1.0 / w[j];
+            }
+
+            ray_packet rays = {x.data(), y.data(), z.data(), u.data(), v.data(), w.data(),
+                               size, inv_u.data(), inv_v.data(), inv_w.data()};
+            bank.object[lookup_queue[first]]->geom.nearest_surface_distances(rays, distance.data());
+
+            for (std::size_t j = 0; j < size; ++j) {
+                bank.distance[lookup_queue[first + j]] = distance[j];
+            }
+        }
+
+        // distance to the next event
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < lookup_queue.size(); ++q) {
+            std::size_t i = lookup_queue[q];
+
+            vec3 position = bank.position(i);
+            vec3 direction = bank.direction(i);
+
+            double surface_distance = bank.distance[i];
+
+            double interaction_dist =
+                -std::log(prng_double(bank.prng_state[i])) / (bank.macro_xs[i] * 10.0e-24);
+
+            double env_distance = env.bounds.distance_along_line(position, direction);
+
+            if (env_distance < surface_distance && env_distance < interaction_dist) {
+                bank.next_event[i] = event::leave;
+                bank.distance[i] = env_distance + 5 * constants::epsilon;
+            } else if (interaction_dist < surface_distance) {
+                bank.next_event[i] = event::collision;
+                bank.distance[i] = interaction_dist;
+            } else {
+                // move tiny bit behind the surface, to not get stuck on it
+                bank.next_event[i] = event::crossing;
+                bank.distance[i] = surface_distance + 5 * constants::epsilon;
+            }
+        }
+
+        // advance to the event, sort out the events
+        collision_queue.clear();
+        crossing_queue.clear();
+
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < lookup_queue.size(); ++q) {
+            std::size_t i = lookup_queue[q];
+            bank.advance(i, bank.distance[i]);
+        }
+
+        for (std::size_t i : lookup_queue) {
+            if (bank.next_event[i] == event::collision) {
+                collision_queue.push_back(i);
+            } else {
+                // elements are recorded only for interactions
+                bank.elem[i] = nullptr;
+                if (bank.next_event[i] == event::crossing) {
+                    crossing_queue.push_back(i);
+                }
+            }
+        }
+
+        // collisions, grouped by element
+        sort_queue(collision_queue, [&](std::size_t i) { return bank.elem[i]->atomic_number; });
+
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < collision_queue.size(); ++q) {
+            std::size_t i = collision_queue[q];
+
+            vec3 direction = bank.direction(i);
+
+            bank.interaction[i] = sample_photon_interaction(*bank.elem[i], bank.elem_xs[i],
+                                                            bank.energy[i], direction,
+                                                            bank.prng_state[i]);
+            bank.u[i] = direction.x();
+            bank.v[i] = direction.y();
+            bank.w[i] = direction.z();
+        }
+
+        // surface crossings
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < crossing_queue.size(); ++q) {
+            std::size_t i = crossing_queue[q];
+            bank.object[i] = env.find_object(bank.position(i));
+        }
+
+        // score the steps
+        #pragma omp parallel for
+        for (std::size_t q = 0; q < alive.size(); ++q) {
+            std::size_t i = alive[q];
+
+            particle_step step = bank.step(i);
+
+            env.scorer.score_step(step);
+
+            if (step.interaction != cross_section::no_interaction) {
+                bank.generation[i]++;
+            }
+
+            if (env.save_particle_paths) {
+                particle_history &history = env.particles[first + i].history;
+                history.points.push_back(step.end);
+                history.energies.push_back(step.end_energy);
+                history.interactions.push_back(step.interaction);
+                history.elements.push_back(step.element);
+                history.objects.push_back(step.object);
+                history.generations.push_back(step.generation);
+            }
+        }
+    }
+}
+
+} // namespace
+
+void calculate_particle_events(environment &env) {
+
+    for (std::size_t first = 0; first < env.batch_particles; first += env.tally_flush_particles) {
+        transport_events(env, first,
+                         std::min(env.tally_flush_particles, env.batch_particles - first));
+        flush_tallies(env);
+    }
+}
+
+} // namespace projector
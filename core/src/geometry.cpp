@@ -15,16 +15,6 @@ constexpr double signum(const double d) {
     return -1;
 }
 
-double distance_to_aligned_plane(double x, double x_0, double u) {
-    if (u == 0.0) {
-        return projector::constants::infinity;
-    }
-    double distance = (x_0 - x) / u;
-
-    return distance < 0.0 ? projector::constants::infinity : distance;
-
-}
-
 } // namespace
 
 namespace projector {
@@ -40,61 +30,29 @@ bool bounding_box::point_inside(const vec3 &point) const {
     return true;
 }
 
-bool bounding_box::point_inside_2d(const vec3& point, std::size_t in1, std::size_t in2) const {
-
-    for (auto& index : {in1, in2}) {
-        if (point[index] < min[index] || point[index] > max[index]) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
 bool bounding_box::line_intersects(const vec3 &point, const vec3 &dir) const {
-    // currently simple implementation using distance
-    // should you slab test https://noonat.github.io/intersect/#aabb-vs-segment
+    auto [entry, exit] = slab_intersect(point, dir.cwiseInverse());
 
-    return distance_along_line(point, dir) < constants::infinity;
+    return entry <= exit && exit >= 0.0;
 }
 
 bool bounding_box::segment_intersect(const vec3 &start, const vec3 &end) const {
 
-    // early trivial check
-    if (point_inside(start) || point_inside(end)) {
-        return true;
-    }
-
-    // to be bit more optimized, we should use slab test:
-    // https://noonat.github.io/intersect/#aabb-vs-segment extended to 3
+    // the direction is not normalized, so the segment is the [0, 1] range of the ray
+    auto [entry, exit] = slab_intersect(start, (end - start).cwiseInverse());
 
-    // simple implementation using distance
-    double dist = distance_along_line(start, end - start);
-
-    return dist <= 1.0;
+    return entry <= exit && exit >= 0.0 && entry <= 1.0;
 }
 
 double bounding_box::distance_along_line(const vec3 &point, const vec3 &dir) const {
-    double distance = constants::infinity;
-    double temp_distance;
-
-    constexpr std::array<std::array<std::size_t, 3>, 3> index_order = {{
-        {0, 1, 2}, {1, 0, 2}, {2, 0, 1}
-    }};
+    auto [entry, exit] = slab_intersect(point, dir.cwiseInverse());
 
-    for (auto& index : index_order) {
-        temp_distance = distance_to_aligned_plane(point[index[0]], min[index[0]], dir[index[0]]);
-        if (point_inside_2d(point + temp_distance * dir, index[1], index[2])) {
-            distance = std::min(distance, temp_distance);
-        }
-
-        temp_distance = distance_to_aligned_plane(point[index[0]], max[index[0]], dir[index[0]]);
-        if (point_inside_2d(point + temp_distance * dir, index[1], index[2])) {
-            distance = std::min(distance, temp_distance);
-        }
-    }
+    return box_distance(entry, exit);
+}
 
-    return distance;
+std::pair<double, double> bounding_box::slab_intersect(const vec3 &point,
+                                                      const vec3 &inv_dir) const {
+    return projector::slab_intersect(min, max, point, inv_dir);
 }
 
 vec3 bounding_box::random_sample(uint64_t &prng_state) const {
@@ -119,6 +77,10 @@ void geometry::add_surface(geometry geom, csg_operation op) {
 
 double geometry::nearest_surface_distance(const vec3 &point, const vec3 &dir) const {
 
+    if (compiled()) {
+        return program.nearest_surface_distance(point, dir);
+    }
+
     auto visitor = [&point, &dir](auto &&arg) {
         using T = std::decay_t<decltype(arg)>;
 
@@ -146,6 +108,10 @@ double geometry::nearest_surface_distance(const vec3 &point, const vec3 &dir) co
 
 bool geometry::point_inside(const vec3 &point) const {
 
+    if (compiled()) {
+        return program.point_inside(point);
+    }
+
     auto visitor = [&point](auto &&arg) {
         using T = std::decay_t<decltype(arg)>;
 
@@ -184,6 +150,31 @@ bool geometry::point_inside(const vec3 &point) const {
     return inside;
 }
 
+void geometry::points_inside(const ray_packet &points, uint8_t *inside) const {
+
+    if (compiled()) {
+        program.points_inside(points, inside);
+        return;
+    }
+
+    for (std::size_t j = 0; j < points.size; ++j) {
+        inside[j] = point_inside({points.x[j], points.y[j], points.z[j]});
+    }
+}
+
+void geometry::nearest_surface_distances(const ray_packet &rays, double *distances) const {
+
+    if (compiled()) {
+        program.nearest_surface_distances(rays, distances);
+        return;
+    }
+
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        distances[j] = nearest_surface_distance({rays.x[j], rays.y[j], rays.z[j]},
+                                                {rays.u[j], rays.v[j], rays.w[j]});
+    }
+}
+
 vec3 geometry::sample_point(uint64_t &prng_state) const {
 
     // basic rejection sampling method:
@@ -242,6 +233,105 @@ void geometry::update_bounding_box(const vec3 &min, const vec3 &max) {
     bb.max = current_max;
 }
 
+bool geometry::is_intersection() const {
+    bool has_operand = false;
+
+    for (auto op : ops) {
+        if (op == csg_operation::no_op) {
+            continue;
+        }
+        if (op != csg_operation::intersect) {
+            return false;
+        }
+        has_operand = true;
+    }
+
+    return has_operand;
+}
+
+void geometry::emit_operand(std::size_t index, csg_program &output) const {
+    if (auto *surf = std::get_if<std::unique_ptr<surface>>(&surfaces[index])) {
+        (*surf)->compile(output);
+    } else {
+        std::get<geometry>(surfaces[index]).emit(output);
+    }
+}
+
+void geometry::emit_intersection_operands(csg_program &output) const {
+    for (std::size_t i = 0; i < surfaces.size(); ++i) {
+        if (ops[i] == csg_operation::no_op) {
+            continue;
+        }
+
+        auto *geom = std::get_if<geometry>(&surfaces[i]);
+        if (geom != nullptr && geom->is_intersection()) {
+            geom->emit_intersection_operands(output);
+        } else {
+            emit_operand(i, output);
+            output.add_operation(csg_opcode::intersect);
+        }
+    }
+}
+
+void geometry::emit(csg_program &output) const {
+
+    // the evaluation starts with true on the stack, intersection with true is a no-op,
+    // so we push it only when the first operation is not an intersection
+    bool started = false;
+
+    for (std::size_t i = 0; i < surfaces.size(); ++i) {
+
+        csg_opcode code;
+
+        switch (ops[i]) {
+        case csg_operation::join:
+            code = csg_opcode::join;
+            break;
+        case csg_operation::intersect:
+            code = csg_opcode::intersect;
+            break;
+        case csg_operation::substract:
+            code = csg_opcode::substract;
+            break;
+        default:
+            continue;
+        }
+
+        auto *geom = std::get_if<geometry>(&surfaces[i]);
+        bool nested_intersection = geom != nullptr && geom->is_intersection();
+
+        if (!started) {
+            started = true;
+            if (code == csg_opcode::intersect) {
+                emit_operand(i, output);
+                continue;
+            }
+            output.add_operation(csg_opcode::push_true);
+        }
+
+        // (a && (b && c)) is the same as ((a && b) && c), no need for the nested value
+        if (code == csg_opcode::intersect && nested_intersection) {
+            geom->emit_intersection_operands(output);
+            continue;
+        }
+
+        emit_operand(i, output);
+        output.add_operation(code);
+    }
+
+    if (!started) {
+        output.add_operation(csg_opcode::push_true);
+    }
+}
+
+void geometry::compile() {
+    csg_program output;
+    emit(output);
+    output.validate();
+
+    program = std::move(output);
+}
+
 vec3 rotate_direction(vec3 dir, double mu, double phi) {
     // done according to PENELOPE 2018 docs and OpenMC source code
     // should be simple axis-angle rotation where axis is the original direction
@@ -0,0 +1,72 @@
+#include "grid_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace projector {
+
+log_grid_index::log_grid_index(std::span<const double> grid, std::size_t bins) {
+
+    // the logarithm is defined only for the positive part of the grid
+    auto first_positive = std::upper_bound(grid.begin(), grid.end(), 0.0);
+
+    if (std::distance(first_positive, grid.end()) < 2 || grid.back() <= *first_positive) {
+        return;
+    }
+
+    if (bins == 0) {
+        bins = grid.size();
+    }
+
+    log_min = std::log(*first_positive);
+    double log_max = std::log(grid.back());
+    inv_bin_width = static_cast<double>(bins) / (log_max - log_min);
+
+    bin_start.resize(bins + 1);
+
+    for (std::size_t b = 0; b <= bins; ++b) {
+        double edge = std::exp(log_min + static_cast<double>(b) / inv_bin_width);
+        auto upper = std::upper_bound(grid.begin(), grid.end(), edge);
+        bin_start[b] = static_cast<uint32_t>(std::distance(grid.begin(), upper));
+    }
+}
+
+std::size_t log_grid_index::upper_bound(double x, std::span<const double> grid) const {
+
+    if (bin_start.empty()) {
+        return std::distance(grid.begin(), std::upper_bound(grid.begin(), grid.end(), x));
+    }
+
+    std::size_t bins = bin_start.size() - 1;
+
+    // the logarithm of zero is -inf, which ends up below the first bin
+    double position = (std::log(x) - log_min) * inv_bin_width;
+
+    std::size_t low, high;
+
+    if (!(position >= 0.0)) {
+        low = 0;
+        high = bin_start.front();
+    } else if (position >= static_cast<double>(bins)) {
+        low = bin_start.back();
+        high = grid.size();
+    } else {
+        std::size_t bin = static_cast<std::size_t>(position);
+        low = bin_start[bin];
+        high = bin_start[bin + 1];
+    }
+
+    auto result = std::upper_bound(grid.begin() + low, grid.begin() + high, x);
+
+    // values rounded into the neighbouring bin, very close to the bin edge
+    bool below = low > 0 && grid[low - 1] > x;
+    bool above = high < grid.size() && grid[high] <= x;
+
+    if (below || above) {
+        result = std::upper_bound(grid.begin(), grid.end(), x);
+    }
+
+    return std::distance(grid.begin(), result);
+}
+
+} // namespace projector
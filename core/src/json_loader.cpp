@@ -2,6 +2,9 @@
 
 #include "utils.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <stdexcept>
 
 namespace {
@@ -17,38 +20,115 @@ std::size_t find_mat_id(const std::string &str, const std::vector<std::string> &
     throw std::runtime_error(std::string("material ID not found:").append(str));
 }
 
+/// Parse the bins of a filter with a bin per value, each bin is a single value or an array of
+/// values. The values are converted to their indices by a function.
+/// @param bins_json the array of the bins
+/// @param value_count the number of the possible values
+/// @param value_index converts a value to its index
+/// @return the bin of each value index, -1 for values not in any bin
+template <typename F>
+std::vector<int> parse_value_bins(const nlohmann::json &bins_json, std::size_t value_count,
+                                  F value_index) {
 
-void parse_box(projector::geometry &output, nlohmann::json &j) {
-    using projector::csg_operation;
-    using projector::plane;
-    using projector::vec3;
+    std::vector<int> bins(value_count, -1);
 
-    vec3 min = vector_from_json<double>(j.at("parameters")[0]);
-    vec3 max = vector_from_json<double>(j.at("parameters")[1]);
+    for (std::size_t bin = 0; bin < bins_json.size(); ++bin) {
+        const nlohmann::json &bin_json = bins_json[bin];
 
-    // botom
-    auto bottom = std::make_unique<plane>(min, vec3{0.0, 0.0, -1.0});
-    output.add_surface(std::move(bottom), csg_operation::intersect);
+        nlohmann::json values = bin_json.is_array() ? bin_json : nlohmann::json::array({bin_json});
 
-    // left
-    auto left = std::make_unique<plane>(min, vec3{-1.0, 0.0, 0.0});
-    output.add_surface(std::move(left), csg_operation::intersect);
+        for (const auto &value : values) {
+            std::size_t index = value_index(value);
 
-    // front
-    auto front = std::make_unique<plane>(min, vec3{0.0, -1.0, 0.0});
-    output.add_surface(std::move(front), csg_operation::intersect);
+            if (bins[index] != -1) {
+                throw std::runtime_error("filter value in multiple bins: " + value.dump());
+            }
+            bins[index] = static_cast<int>(bin);
+        }
+    }
 
-    // top
-    auto top = std::make_unique<plane>(max, vec3{0.0, 0.0, 1.0});
-    output.add_surface(std::move(top), csg_operation::intersect);
+    return bins;
+}
+
+/// Parse a filter definition, the objects and materials must be already loaded
+projector::tally_filter parse_filter(const nlohmann::json &j, const projector::environment &env) {
+    using projector::cross_section;
+    using projector::filter_type;
+
+    projector::tally_filter filter;
+
+    j.at("id").get_to(filter.id);
+    j.at("type").get_to(filter.type);
+    filter.slot = env.filters.size();
+
+    const nlohmann::json &bins_json = j.at("bins");
+
+    if (!bins_json.is_array() || bins_json.empty()) {
+        throw std::runtime_error("filter bins are not a non-empty array: " + filter.id);
+    }
+
+    switch (filter.type) {
+    case filter_type::energy:
+    case filter_type::generation:
+        bins_json.get_to(filter.edges);
 
-    // right
-    auto right = std::make_unique<plane>(max, vec3{1.0, 0.0, 0.0});
-    output.add_surface(std::move(right), csg_operation::intersect);
+        if (filter.edges.size() < 2 ||
+            std::adjacent_find(filter.edges.begin(), filter.edges.end(),
+                               std::greater_equal<double>()) != filter.edges.end()) {
+            throw std::runtime_error("filter bin edges are not increasing: " + filter.id);
+        }
+
+        filter.bin_count = filter.edges.size() - 1;
+        break;
+
+    case filter_type::interaction: {
+        std::size_t interaction_count =
+            static_cast<std::size_t>(cross_section::pair_production) + 1;
+
+        filter.bins = parse_value_bins(bins_json, interaction_count, [](const auto &value) {
+            cross_section interaction = value.template get<cross_section>();
+
+            // unknown names are read as the first interaction
+            if (nlohmann::json(interaction) != value) {
+                throw std::runtime_error("unknown interaction: " + value.dump());
+            }
+            return static_cast<std::size_t>(interaction);
+        });
+        filter.bin_count = bins_json.size();
+        break;
+    }
+
+    case filter_type::object:
+        filter.bins = parse_value_bins(bins_json, env.objects.size(), [&env](const auto &value) {
+            std::string id = value.template get<std::string>();
 
-    // back
-    auto back = std::make_unique<plane>(max, vec3{0.0, 1.0, 0.0});
-    output.add_surface(std::move(back), csg_operation::intersect);
+            auto found = std::find_if(env.objects.begin(), env.objects.end(),
+                                      [&id](const projector::object &obj) { return obj.id == id; });
+
+            if (found == env.objects.end()) {
+                throw std::runtime_error("object ID not found: " + id);
+            }
+            return static_cast<std::size_t>(std::distance(env.objects.begin(), found));
+        });
+        filter.bin_count = bins_json.size();
+        break;
+
+    case filter_type::material: {
+        std::vector<int> material_bins =
+            parse_value_bins(bins_json, env.material_ids.size(), [&env](const auto &value) {
+                return find_mat_id(value.template get<std::string>(), env.material_ids);
+            });
+
+        // the steps know their object, bin the objects by their material
+        for (const auto &obj : env.objects) {
+            filter.bins.push_back(material_bins[obj.material_id]);
+        }
+        filter.bin_count = bins_json.size();
+        break;
+    }
+    }
+
+    return filter;
 }
 
 template <typename T>
@@ -110,6 +190,17 @@ std::unique_ptr<surface> parse_surface(nlohmann::json &j) {
         return std::make_unique<plane>(center, normal);
     }
 
+    if (surf_type == "box") {
+        // the first parameter is the min corner
+        vec3 max = vector_from_json<double>(j.at("parameters")[1]);
+        return std::make_unique<box>(center, max);
+    }
+
+    if (surf_type == "quadric") {
+        auto coefficients = j.at("parameters")[1].get<std::array<double, 10>>();
+        return std::make_unique<quadric>(center, coefficients);
+    }
+
     double a = j.at("parameters")[1].get<double>();
     double b = j.at("parameters")[2].get<double>();
     double c = 0.0;
@@ -175,12 +266,7 @@ void parse_geometry(geometry &geom, std::string_view key, nlohmann::json &j) {
 
             std::string_view surf_type = current_surface.at("type").get<std::string_view>();
 
-            if (surf_type == "box") {
-                geometry box;
-                parse_box(box, current_surface);
-                geom.add_surface(std::move(box), geom_json.at("operators")[i]);
-
-            } else if (surf_type == "capped_x_cylinder") {
+            if (surf_type == "capped_x_cylinder") {
                 geometry cyl;
                 parse_capped_cylinder<x_cylinder>(cyl, current_surface, vec3{1.0, 0.0, 0.0});
                 geom.add_surface(std::move(cyl), geom_json.at("operators")[i]);
@@ -236,6 +322,21 @@ void load_simulation_data(std::filesystem::path path, environment &env) {
     conf.at("energy_cutoff").get_to(env.energy_cutoff);
     conf.at("stack_size").get_to(env.stack_size);
 
+    env.batch_size = conf.value("batch_size", std::size_t{0});
+    env.target_relative_error = conf.value("target_relative_error", 0.0);
+    env.convergence_score_fraction = conf.value("convergence_score_fraction", 0.0);
+    env.convergence_tally_ids = conf.value("convergence_tallies", std::vector<std::string>{});
+    env.accumulation = conf.value("tally_accumulation", tally_accumulation::atomic);
+
+    // the relative error is known only with batch statistics
+    if (env.target_relative_error > 0.0 && env.batch_size == 0) {
+        throw std::runtime_error("target_relative_error needs batch_size");
+    }
+
+    if (env.convergence_score_fraction < 0.0 || env.convergence_score_fraction > 1.0) {
+        throw std::runtime_error("convergence_score_fraction must be between 0 and 1");
+    }
+
 
     vec3 min_bb = vector_from_json<double>(conf.at("bounding_box").at(0));
     vec3 max_bb = vector_from_json<double>(conf.at("bounding_box").at(1));
@@ -303,6 +404,14 @@ void load_material_data(std::filesystem::path path, environment &env) {
     if (env.materials.size() != env.material_ids.size()) {
         throw std::runtime_error("Error while loading material data, length mismatch");
     }
+
+    env.cross_section_data.load_elements(env.materials);
+    env.cross_section_data.build_union_grid(env.materials);
+    env.cross_section_data.build_sampling_tables(env.materials);
+
+    for (material_data &material : env.materials) {
+        env.cross_section_data.material_build_tables(material);
+    }
 }
 
 void load_object_data(std::filesystem::path path, environment &env) {
@@ -359,9 +468,12 @@ void load_object_data(std::filesystem::path path, environment &env) {
         }
 
         new_obj.geom.update_bounding_box(min_bb, max_bb);
+        new_obj.geom.compile();
 
         env.objects.push_back(std::move(new_obj));
     }
+
+    env.build_object_tree();
 }
 
 void load_tally_data(std::filesystem::path path, environment &env) {
@@ -376,6 +488,21 @@ void load_tally_data(std::filesystem::path path, environment &env) {
         throw std::runtime_error("No array of tallies in JSON");
     }
 
+    // filters are shared by the tallies, which refer to them by their ids
+    for (auto &filter_json : file.value("filters", nlohmann::json::array())) {
+        auto filter = std::make_unique<tally_filter>(parse_filter(filter_json, env));
+
+        for (const auto &other : env.filters) {
+            if (other->id == filter->id) {
+                throw std::runtime_error("duplicate filter ID: " + filter->id);
+            }
+        }
+
+        env.filters.emplace_back(std::move(filter));
+    }
+
+    std::vector<std::string> tally_ids;
+
     for (auto &tally_json : file.at("tallies")) {
         std::string type;
         tally_json.at("type").get_to(type);
@@ -394,9 +521,38 @@ void load_tally_data(std::filesystem::path path, environment &env) {
         vec3 end = vector_from_json<double>(tally_json.at("parameters").at("end"));
         coord3 resolution = vector_from_json<int>(tally_json.at("parameters").at("resolution"));
 
-        auto tally = std::make_unique<uniform_mesh_tally>(id, start, end, resolution, score);
+        std::vector<const tally_filter *> filters;
+
+        for (auto &filter_id : tally_json.value("filters", std::vector<std::string>{})) {
+            auto found = std::find_if(env.filters.begin(), env.filters.end(),
+                                      [&filter_id](const auto &f) { return f->id == filter_id; });
+
+            if (found == env.filters.end()) {
+                throw std::runtime_error("filter ID not found: " + filter_id);
+            }
+            filters.push_back(found->get());
+        }
+
+        auto tally = std::make_unique<uniform_mesh_tally>(id, start, end, resolution, score,
+                                                          env.accumulation, filters);
 
         env.tallies.emplace_back(std::move(tally));
+        tally_ids.push_back(id);
+    }
+
+    // all tallies are checked for convergence if not specified
+    if (env.convergence_tally_ids.empty()) {
+        env.convergence_tally_ids = tally_ids;
+    }
+
+    for (auto &id : env.convergence_tally_ids) {
+        auto found = std::find(tally_ids.begin(), tally_ids.end(), id);
+
+        if (found == tally_ids.end()) {
+            throw std::runtime_error("convergence tally ID not found: " + id);
+        }
+
+        env.convergence_tallies.push_back(std::distance(tally_ids.begin(), found));
     }
 }
 
@@ -17,23 +17,34 @@ int main(int argc, char *argv[]) {
     CLI::App &run_subcommand = *app.add_subcommand("run", "run simulation from input files");
     CLI::App &parse_subcommand = *app.add_subcommand("validate", "validates input files");
     CLI::App &vis_subcommand = *app.add_subcommand("visualize", "plot input geometry");
+    CLI::App &cache_subcommand =
+        *app.add_subcommand("cache", "convert ACE data to the binary cache");
 
     std::string config_path_str;
     std::string xcom_path;
     std::string xsdir_path;
+    std::string xs_cache_path;
     int thread_count = 1;
+    std::string grid_search;
 
     double vis_center;
     std::vector<std::size_t> vis_resolution;
     char vis_plane;
     std::string vis_output_path;
 
+    std::string engine;
+
     app.require_subcommand(1);
     app.add_option("--ace_data, -a", xsdir_path, "Path to eprdata14 xsdir")
         ->envname("PROJECTOR_ACE_XSDIR")
         ->required()
         ->check(CLI::ExistingFile);
+    app.add_option("--xs_cache, -x", xs_cache_path, "Path to binary cross section cache")
+        ->envname("PROJECTOR_XS_CACHE");
     app.add_option("--thread_count, -t", thread_count, "Max threads to use");
+    app.add_option("--grid_search, -g", grid_search, "Cross section grid search")
+        ->check(CLI::IsMember({"binary", "hash"}))
+        ->default_val("hash");
     app.set_help_all_flag("--help-all", "Show help for all subcommands");
 
     vis_subcommand.add_option("-s, --slice", vis_plane, "Slice plane")
@@ -57,17 +68,46 @@ int main(int argc, char *argv[]) {
     run_subcommand.add_option("INPUT", config_path_str, "Input JSON file")
         ->required()
         ->check(CLI::ExistingFile);
+    run_subcommand.add_option("-e, --engine", engine, "Transport engine")
+        ->check(CLI::IsMember({"history", "event"}))
+        ->default_val("history");
 
     CLI11_PARSE(app, argc, argv);
 
     std::cout << termcolor::blue << termcolor::bold << "<<-- Projector -->>" << termcolor::reset
               << std::endl;
 
+    if (cache_subcommand) {
+        if (xs_cache_path.empty()) {
+            xs_cache_path = xsdir_path + ".bin";
+        }
+
+        std::cout << "Converting cross section data from: " << xsdir_path << std::endl;
+        try {
+            projector::data_library::write_binary_data(xsdir_path, xs_cache_path);
+        } catch (const std::exception &e) {
+            print_nested_exception(e);
+            return EXIT_FAILURE;
+        }
+
+        std::cout << "Saved binary cache to: " << xs_cache_path << std::endl;
+        return EXIT_SUCCESS;
+    }
+
     projector::environment sim_env;
 
     std::cout << "Loading cross section data from: " << xsdir_path << std::endl;
     try {
-        sim_env.cross_section_data = projector::data_library::load_ace_data(xsdir_path);
+        if (xs_cache_path.empty()) {
+            sim_env.cross_section_data = projector::data_library::load_ace_data(xsdir_path);
+        } else {
+            std::cout << "Using binary cache: " << xs_cache_path << std::endl;
+            sim_env.cross_section_data =
+                projector::data_library::load_binary_data(xsdir_path, xs_cache_path);
+        }
+        sim_env.cross_section_data.set_grid_search(grid_search == "hash"
+                                                       ? projector::grid_search::log_hash
+                                                       : projector::grid_search::binary);
     } catch (const std::exception &e) {
         print_nested_exception(e);
         return EXIT_FAILURE;
@@ -132,17 +172,42 @@ int main(int argc, char *argv[]) {
 
 
     if (run_subcommand) {
-        std::cout << "Initializing runtime" << std::endl;
-        projector::initialize_runtime(sim_env, thread_count);
-
-        std::cout << "Running particle simulation" << std::endl;
-        projector::calculate_particle_histories(sim_env);
+        // the tallies report errors found while reducing their scores, ie. a fixed point overflow
+        try {
+            std::cout << "Initializing runtime" << std::endl;
+            projector::initialize_runtime(sim_env, thread_count);
+
+            std::cout << "Running particle simulation, engine: " << engine << std::endl;
+            while (projector::source_batch(sim_env)) {
+                if (engine == "event") {
+                    projector::calculate_particle_events(sim_env);
+                } else {
+                    projector::calculate_particle_histories(sim_env);
+                }
+
+                if (projector::finish_batch(sim_env)) {
+                    std::cout << "Target relative error reached" << std::endl;
+                    break;
+                }
+            }
+
+            if (engine == "history") {
+                std::cout << "Cross section cache hits: " << sim_env.xs_cache_hits
+                          << ", misses: " << sim_env.xs_cache_misses << std::endl;
+            }
+
+            std::cout << "Processing tallies" << std::endl;
+            projector::process_tallies(sim_env);
+
+            std::cout << "Saving data to: " << sim_env.output_path << std::endl;
+            projector::save_data(sim_env);
+
+        } catch (const std::exception &e) {
+            print_nested_exception(e);
+            return EXIT_FAILURE;
+        }
 
-        std::cout << "Processing tallies" << std::endl;
-        projector::process_tallies(sim_env);
-
-        std::cout << "Saving data to: " << sim_env.output_path << std::endl;
-        projector::save_data(sim_env);
+        return EXIT_SUCCESS;
     }
 
     std::cout << "Invalid subcommand, exiting" << std::endl;
@@ -0,0 +1,33 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace projector {
+
+mapped_file::mapped_file(const std::filesystem::path &path) : address(MAP_FAILED) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed opening " + path.string());
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        length = static_cast<std::size_t>(info.st_size);
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    close(fd);
+
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Failed mapping " + path.string());
+    }
+}
+
+mapped_file::~mapped_file() { munmap(address, length); }
+
+} // namespace projector
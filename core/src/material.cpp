@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <map>
+#include <stdexcept>
 #include <string>
 #include <utility>
 
@@ -60,22 +62,28 @@ void normalize_vector(std::vector<double> &vec) {
     }
 }
 
-std::pair<std::size_t, double> calculate_interpolation_values(double x,
-                                                              const std::vector<double> &values) {
+std::pair<std::size_t, double>
+calculate_interpolation_values(double x, std::span<const double> values,
+                               const projector::log_grid_index &search_index) {
 
-    auto index_iter = std::lower_bound(values.begin(), values.end(), x);
+    // the interval is [values[index], values[index + 1]), energies at discontinuities are
+    // repeated in the grid, for them the last one (the value above the edge) is used
+    std::ptrdiff_t upper = search_index.upper_bound(x, values);
 
-    double left_val = *index_iter;
-    double right_val = *std::next(index_iter);
+    std::ptrdiff_t last_interval = static_cast<std::ptrdiff_t>(values.size()) - 2;
+    std::size_t index = std::clamp<std::ptrdiff_t>(upper - 1, 0, last_interval);
 
-    std::size_t index = std::distance(values.begin(), index_iter);
+    double left_val = values[index];
+    double right_val = values[index + 1];
 
-    double t = (x - left_val) / (right_val - left_val);
+    // outside of the grid the end values are used
+    double t = std::clamp((x - left_val) / (right_val - left_val), 0.0, 1.0);
 
     return {index, t};
 }
 
-double interpolate(const std::vector<double> &x_vals, const std::vector<double> &y_vals, double x) {
+double interpolate(std::span<const double> x_vals, std::span<const double> y_vals, double x,
+                   const projector::log_grid_index &search_index) {
 
     if (x <= x_vals.front()) {
         return y_vals.front();
@@ -85,11 +93,138 @@ double interpolate(const std::vector<double> &x_vals, const std::vector<double>
         return y_vals.back();
     }
 
-    auto [index, t] = calculate_interpolation_values(x, x_vals);
+    auto [index, t] = calculate_interpolation_values(x, x_vals, search_index);
 
     return std::lerp(y_vals[index], y_vals[index + 1], t);
 }
 
+/// Sorted atomic numbers of the elements used by the materials
+std::vector<std::size_t> used_elements(const std::vector<projector::material_data> &materials) {
+    std::vector<std::size_t> used;
+    for (const auto &mat : materials) {
+        used.insert(used.end(), mat.elements.begin(), mat.elements.end());
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    return used;
+}
+
+/// Number of energies per decade of the sampling tables
+constexpr std::size_t table_points_per_decade = 16;
+
+/// Points of the grid the incoherent scattering distribution is integrated on
+constexpr std::size_t compton_grid_points = 4096;
+
+/// Calculate the quantiles of the scattering cosine from the cumulative distribution of
+/// v = sqrt((1 - mu) / 2), tabulated on a uniform grid of v on [0, 1].
+///
+/// @param cdf the cumulative distribution, not normalized
+/// @param step the step of the v grid
+/// @param mu_out quantile_count + 1 cosines
+void inverse_cdf_quantiles(const std::vector<double> &cdf, double step, double *mu_out) {
+
+    constexpr std::size_t count = projector::angular_table::quantile_count;
+
+    double total = cdf.back();
+
+    std::size_t j = 0;
+    for (std::size_t k = 0; k <= count; ++k) {
+        double target = total * static_cast<double>(k) / count;
+
+        while (j + 2 < cdf.size() && cdf[j + 1] < target) {
+            ++j;
+        }
+
+        // the cumulative distribution is linear between the grid points
+        double width = cdf[j + 1] - cdf[j];
+        double t = width > 0.0 ? std::clamp((target - cdf[j]) / width, 0.0, 1.0) : 0.0;
+        double v = (static_cast<double>(j) + t) * step;
+
+        mu_out[k] = 1.0 - 2.0 * v * v;
+    }
+}
+
+/// Calculate the quantiles of the coherent scattering cosine at one energy.
+///
+/// The momentum transfer variable s is distributed with density F^2(s) (1 + mu^2) / 2 on
+/// [0, s_max], with mu = 1 - 2 s / s_max. The cumulative F^2 is linear between the points of the
+/// form factor grid, so F^2 is constant in each interval and the integral of (1 + mu^2) / 2,
+/// W(s) = s / 2 - s_max mu^3 / 12, gives the exact cumulative distribution.
+///
+/// @param s_grid the form factor grid
+/// @param cumulative the cumulative F^2 on the grid
+/// @param s_max the maximum momentum transfer at the energy
+/// @param mu_out quantile_count + 1 cosines
+void rayleigh_quantiles(std::span<const double> s_grid, std::span<const double> cumulative,
+                        double s_max, double *mu_out) {
+
+    auto mu = [s_max](double s) { return 1.0 - 2.0 * s / s_max; };
+    auto w = [s_max, &mu](double s) { return 0.5 * s - s_max * std::pow(mu(s), 3) / 12.0; };
+
+    // intervals of constant density below s_max, with the distribution at their start
+    struct interval {
+        double start;
+        double end;
+        double density;
+        double cdf;
+    };
+    std::vector<interval> intervals;
+
+    double total = 0.0;
+    for (std::size_t i = 0; i + 1 < s_grid.size() && s_grid[i] < s_max; ++i) {
+        double width = s_grid[i + 1] - s_grid[i];
+        if (width <= 0.0) {
+            continue;
+        }
+
+        double density = (cumulative[i + 1] - cumulative[i]) / width;
+        double end = std::min(s_grid[i + 1], s_max);
+
+        intervals.push_back({s_grid[i], end, density, total});
+        total += density * (w(end) - w(s_grid[i]));
+    }
+
+    // no form factor data, only the Thomson term
+    if (!(total > 0.0)) {
+        intervals = {{0.0, s_max, 1.0, 0.0}};
+        total = w(s_max) - w(0.0);
+    }
+
+    constexpr std::size_t count = projector::angular_table::quantile_count;
+
+    std::size_t current = 0;
+    for (std::size_t k = 0; k <= count; ++k) {
+        double target = total * static_cast<double>(k) / count;
+
+        while (current + 1 < intervals.size() && intervals[current + 1].cdf <= target) {
+            ++current;
+        }
+
+        const interval &bin = intervals[current];
+
+        if (bin.density <= 0.0) {
+            mu_out[k] = mu(bin.start);
+            continue;
+        }
+
+        // W is increasing, solve W(s) = W(start) + (target - cdf) / density by bisection
+        double w_target = w(bin.start) + (target - bin.cdf) / bin.density;
+        double low = bin.start;
+        double high = bin.end;
+
+        for (int iteration = 0; iteration < 64 && low < high; ++iteration) {
+            double mid = 0.5 * (low + high);
+            (w(mid) < w_target ? low : high) = mid;
+        }
+
+        mu_out[k] = mu(0.5 * (low + high));
+    }
+
+    // the first quantile is exactly forward
+    mu_out[0] = 1.0;
+}
+
 std::pair<double, double> klein_nishina(double k, uint64_t &prng_state) {
     using projector::prng_double;
 
@@ -152,18 +287,18 @@ double element::get_cross_section(double energy, cross_section xs_type) const {
 
     std::size_t xs = static_cast<std::size_t>(xs_type);
 
-    return interpolate(xs_data[0], xs_data[xs], energy);
+    return interpolate(xs_data[0], xs_data[xs], energy, xs_index);
 }
 
 double element::get_form_factor(double x, form_factor ff_type) const {
 
     switch (ff_type) {
     case form_factor::incoherent:
-        return interpolate(ff_data[0], ff_data[1], x);
+        return interpolate(ff_data[0], ff_data[1], x, incoherent_index);
     case form_factor::cumulative_coherent:
-        return interpolate(ff_data[2], ff_data[3], x);
+        return interpolate(ff_data[2], ff_data[3], x, coherent_index);
     case form_factor::differential_coherent:
-        return interpolate(ff_data[2], ff_data[4], x);
+        return interpolate(ff_data[2], ff_data[4], x, coherent_index);
     default:
         throw std::runtime_error("invalid form factor request!");
     }
@@ -173,7 +308,7 @@ double element::get_form_factor(double x, form_factor ff_type) const {
 
 sampled_xs element::get_all_cross_sections(double energy) const {
 
-    auto [index, t] = calculate_interpolation_values(energy, xs_data[0]);
+    auto [index, t] = calculate_interpolation_values(energy, xs_data[0], xs_index);
 
     sampled_xs xs;
     xs.coherent = std::lerp(xs_data[1][index], xs_data[1][index + 1], t);
@@ -186,8 +321,162 @@ sampled_xs element::get_all_cross_sections(double energy) const {
     return xs;
 }
 
+sampled_xs element::get_all_cross_sections(std::size_t index, double t) const {
+
+    const xs_point &left = union_xs[index];
+    const xs_point &right = union_xs[index + 1];
+
+    sampled_xs xs;
+    xs.coherent = std::lerp(left.coherent, right.coherent, t);
+    xs.incoherent = std::lerp(left.incoherent, right.incoherent, t);
+    xs.photoelectric = std::lerp(left.photoelectric, right.photoelectric, t);
+    xs.pair_production = std::lerp(left.pair_production, right.pair_production, t);
+
+    xs.total = xs.coherent + xs.incoherent + xs.photoelectric + xs.pair_production;
+
+    return xs;
+}
+
+void element::build_union_table(const std::vector<double> &union_energy) {
+
+    std::span<const double> grid = xs_data[0];
+
+    union_xs.clear();
+    union_xs.reserve(union_energy.size());
+
+    // repeated energy in the union grid, the copy index selects the side of the discontinuity
+    std::size_t copy = 0;
+
+    for (std::size_t u = 0; u < union_energy.size(); ++u) {
+        double energy = union_energy[u];
+
+        copy = (u > 0 && union_energy[u - 1] == energy) ? copy + 1 : 0;
+
+        auto [first, last] = std::equal_range(grid.begin(), grid.end(), energy);
+
+        if (first == last) {
+            union_xs.push_back({interpolate(grid, xs_data[1], energy, xs_index),
+                                interpolate(grid, xs_data[2], energy, xs_index),
+                                interpolate(grid, xs_data[3], energy, xs_index),
+                                interpolate(grid, xs_data[4], energy, xs_index)});
+            continue;
+        }
+
+        // the energy is in the element grid, take the value directly
+        std::size_t count = std::distance(first, last);
+        std::size_t index = std::distance(grid.begin(), first) + std::min(copy, count - 1);
+
+        union_xs.push_back(
+            {xs_data[1][index], xs_data[2][index], xs_data[3][index], xs_data[4][index]});
+    }
+}
+
+void element::set_grid_search(grid_search method) {
+
+    if (method == grid_search::log_hash) {
+        xs_index = log_grid_index(xs_data[0]);
+        incoherent_index = log_grid_index(ff_data[0]);
+        coherent_index = log_grid_index(ff_data[2]);
+        cumulative_coherent_index = log_grid_index(ff_data[3]);
+    } else {
+        xs_index = {};
+        incoherent_index = {};
+        coherent_index = {};
+        cumulative_coherent_index = {};
+    }
+}
+
+void angular_table::init(double min_energy, double max_energy, std::size_t points_per_decade) {
+
+    double decades = std::log10(max_energy / min_energy);
+
+    energies = std::max<std::size_t>(2, std::ceil(decades * points_per_decade) + 1);
+    log_min = std::log(min_energy);
+    inv_step = (energies - 1) / (std::log(max_energy) - log_min);
+
+    quantiles.assign(energies * (quantile_count + 1), 0.0);
+}
+
+double angular_table::energy(std::size_t index) const {
+    return std::exp(log_min + static_cast<double>(index) / inv_step);
+}
+
+double angular_table::sample(double energy, uint64_t &prng_state) const {
+
+    double last = static_cast<double>(energies - 1);
+    double position = std::clamp((std::log(energy) - log_min) * inv_step, 0.0, last);
+
+    std::size_t index = static_cast<std::size_t>(position);
+
+    if (position < last && prng_double(prng_state) < position - static_cast<double>(index)) {
+        ++index;
+    }
+
+    double u = prng_double(prng_state) * quantile_count;
+    std::size_t k = std::min(static_cast<std::size_t>(u), quantile_count - 1);
+
+    const double *cosines = quantiles.data() + index * (quantile_count + 1);
+
+    return std::lerp(cosines[k], cosines[k + 1], u - static_cast<double>(k));
+}
+
+void element::build_sampling_tables() {
+
+    std::span<const double> grid = energy_grid();
+
+    rayleigh_table.init(grid.front(), grid.back(), table_points_per_decade);
+
+    for (std::size_t i = 0; i < rayleigh_table.energies; ++i) {
+        double k = rayleigh_table.energy(i) / constants::electron_mass_ev;
+        double x2_max = (constants::electron_mass_ev / constants::planck_c) * k;
+
+        rayleigh_quantiles(ff_data[2], ff_data[3], x2_max, rayleigh_table.row(i));
+    }
+
+    compton_table.init(grid.front(), grid.back(), table_points_per_decade);
+
+    std::vector<double> cdf(compton_grid_points);
+
+    for (std::size_t i = 0; i < compton_table.energies; ++i) {
+        double k = compton_table.energy(i) / constants::electron_mass_ev;
+
+        // Klein-Nishina cross section times the incoherent scattering function, integrated over
+        // v = sqrt((1 - mu) / 2), where dmu = 4 v dv
+        auto density = [this, k](double v) {
+            double mu = 1.0 - 2.0 * v * v;
+            double ratio = 1.0 / (1.0 + k * (1.0 - mu));
+            double x = constants::electron_mass_ev / constants::planck_c * k * ratio * v;
+
+            double klein_nishina = ratio * ratio * (ratio + 1.0 / ratio - (1.0 - mu * mu));
+
+            return klein_nishina * get_form_factor(x, form_factor::incoherent) * 4.0 * v;
+        };
+
+        double step = 1.0 / (compton_grid_points - 1);
+        double previous = density(0.0);
+
+        cdf[0] = 0.0;
+        for (std::size_t j = 1; j < compton_grid_points; ++j) {
+            double current = density(j * step);
+            cdf[j] = cdf[j - 1] + 0.5 * step * (previous + current);
+            previous = current;
+        }
+
+        inverse_cdf_quantiles(cdf, step, compton_table.row(i));
+    }
+}
+
 double element::rayleigh(double energy, uint64_t &prng_state) const {
 
+    if (rayleigh_table.empty()) {
+        return rayleigh_rejection(energy, prng_state);
+    }
+
+    return rayleigh_table.sample(energy, prng_state);
+}
+
+double element::rayleigh_rejection(double energy, uint64_t &prng_state) const {
+
     double mu = 0.0;
 
     double k = energy / constants::electron_mass_ev;
@@ -199,7 +488,7 @@ double element::rayleigh(double energy, uint64_t &prng_state) const {
     while (true) {
         double f = prng_double(prng_state) * f_max;
 
-        double x2 = interpolate(ff_data[3], ff_data[2], f);
+        double x2 = interpolate(ff_data[3], ff_data[2], f, cumulative_coherent_index);
 
         mu = 1.0 - 2.0 * x2 / x2_max;
 
@@ -213,6 +502,21 @@ double element::rayleigh(double energy, uint64_t &prng_state) const {
 
 std::pair<double, double> element::compton(double energy, uint64_t &prng_state) const {
 
+    if (compton_table.empty()) {
+        return compton_rejection(energy, prng_state);
+    }
+
+    double k = energy / constants::electron_mass_ev;
+    double mu = compton_table.sample(energy, prng_state);
+
+    // the outgoing energy is given by the cosine
+    double k_out = k / (1.0 + k * (1.0 - mu));
+
+    return {k_out * constants::electron_mass_ev, mu};
+}
+
+std::pair<double, double> element::compton_rejection(double energy, uint64_t &prng_state) const {
+
     double k = energy / constants::electron_mass_ev;
 
     double x_max = (constants::electron_mass_ev / constants::planck_c) * k;
@@ -241,43 +545,152 @@ std::pair<double, double> element::compton(double energy, uint64_t &prng_state)
 
 double data_library::material_macro_xs(const material_data &mat, double energy) const {
 
-    double total_xs = 0.0;
+    auto [index, t] = union_grid_position(energy);
 
-    for (std::size_t i = 0; i < mat.elements.size(); ++i) {
-        double atomic_density = mat.atom_density[i];
-        sampled_xs elem_xs = get_element(mat.elements[i]).get_all_cross_sections(energy);
-        total_xs += atomic_density * elem_xs.total;
-    }
+    std::size_t count = mat.elements.size();
+    const double *left = mat.macro_xs_cumulative.data() + index * count;
 
-    return total_xs;
+    return std::lerp(left[count - 1], left[2 * count - 1], t);
 };
 
 const element &data_library::get_element(std::size_t atomic_number) const {
     return elements[atomic_number - 1];
 }
 
-std::pair<double, const element &> data_library::sample_material(const material_data &material,
-                                                                 double energy,
-                                                                 uint64_t &prng_state) const {
+void data_library::set_grid_search(grid_search method) {
+
+    search_method = method;
+
+    for (element &elem : elements) {
+        elem.set_grid_search(method);
+    }
+
+    union_index = method == grid_search::log_hash ? log_grid_index(union_energy) : log_grid_index();
+}
+
+void data_library::build_union_grid(const std::vector<material_data> &materials) {
+
+    std::vector<std::size_t> used = used_elements(materials);
+
+    // energies repeated in an element grid mark discontinuities (absorption edges), they are
+    // kept in the union grid as many times as in the element with most repeats
+    std::map<double, std::size_t> repeats;
+
+    for (std::size_t atomic_number : used) {
+        if (!get_element(atomic_number).loaded()) {
+            throw std::runtime_error("Element " + std::to_string(atomic_number) + " is not loaded");
+        }
+
+        std::span<const double> grid = get_element(atomic_number).energy_grid();
+
+        for (auto it = grid.begin(); it != grid.end();) {
+            auto next = std::upper_bound(it, grid.end(), *it);
+            std::size_t &count = repeats[*it];
+            count = std::max<std::size_t>(count, std::distance(it, next));
+            it = next;
+        }
+    }
+
+    union_energy.clear();
+    for (auto [energy, count] : repeats) {
+        union_energy.insert(union_energy.end(), count, energy);
+    }
+
+    if (union_energy.size() < 2) {
+        throw std::runtime_error("union energy grid needs at least two points");
+    }
+
+    for (std::size_t atomic_number : used) {
+        elements[atomic_number - 1].build_union_table(union_energy);
+    }
+
+    if (search_method == grid_search::log_hash) {
+        union_index = log_grid_index(union_energy);
+    }
+}
+
+void data_library::build_sampling_tables(const std::vector<material_data> &materials) {
 
-    // calculate total material macro xs
-    std::vector<double> total_xs_cumulative;
+    std::vector<std::size_t> used = used_elements(materials);
 
-    double temp = 0.0;
-    for (std::size_t i = 0; i < material.elements.size(); ++i) {
-        double elem_xs = get_element(material.elements[i]).get_all_cross_sections(energy).total;
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < used.size(); ++i) {
+        elements[used[i] - 1].build_sampling_tables();
+    }
+}
+
+std::pair<std::size_t, double> data_library::union_grid_position(double energy) const {
 
-        temp += elem_xs * material.atom_density[i];
-        total_xs_cumulative.push_back(temp);
+    if (union_energy.empty()) {
+        throw std::runtime_error("union energy grid is not built");
     }
 
+    return calculate_interpolation_values(energy, union_energy, union_index);
+}
+
+material_sample data_library::sample_material(const material_data &material, double energy,
+                                              uint64_t &prng_state) const {
+
+    // one search in the union grid for all the elements
+    auto [index, t] = union_grid_position(energy);
+
+    // rows of the cumulative table around the energy
+    std::size_t count = material.elements.size();
+    const double *left = material.macro_xs_cumulative.data() + index * count;
+    const double *right = left + count;
+
+    double total = std::lerp(left[count - 1], right[count - 1], t);
+
     // sample an element
-    double sample = prng_double(prng_state) * total_xs_cumulative.back();
+    double sample = prng_double(prng_state) * total;
 
-    for (std::size_t i = 0; i < total_xs_cumulative.size(); ++i) {
-        if (sample < total_xs_cumulative[i]) {
-            return {total_xs_cumulative.back(), get_element(material.elements[i])};
-            break;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (sample < std::lerp(left[i], right[i], t)) {
+            const element &elem = get_element(material.elements[i]);
+            return {total, &elem, elem.get_all_cross_sections(index, t)};
+        }
+    }
+
+    throw std::runtime_error("Couldn't sample element");
+}
+
+material_sample data_library::sample_material(const material_data &material, double energy,
+                                              uint64_t &prng_state,
+                                              material_xs_cache &cache) const {
+
+    std::size_t count = material.elements.size();
+
+    if (cache.material == &material && cache.energy == energy) {
+        cache.hits++;
+    } else {
+        cache.misses++;
+
+        auto [index, t] = union_grid_position(energy);
+
+        const double *left = material.macro_xs_cumulative.data() + index * count;
+        const double *right = left + count;
+
+        // the storage is reused, it only grows with the element count
+        cache.cumulative.resize(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            cache.cumulative[i] = std::lerp(left[i], right[i], t);
+        }
+
+        cache.material = &material;
+        cache.energy = energy;
+        cache.index = index;
+        cache.t = t;
+    }
+
+    double total = cache.cumulative.back();
+
+    // sample an element
+    double sample = prng_double(prng_state) * total;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        if (sample < cache.cumulative[i]) {
+            const element &elem = get_element(material.elements[i]);
+            return {total, &elem, elem.get_all_cross_sections(cache.index, cache.t)};
         }
     }
 
@@ -342,6 +755,28 @@ void data_library::material_calculate_missing_values(material_data &mat) const {
     }
 }
 
+void data_library::material_build_tables(material_data &mat) const {
+
+    std::size_t count = mat.elements.size();
+
+    mat.macro_xs_cumulative.resize(union_energy.size() * count);
+
+    for (std::size_t u = 0; u < union_energy.size(); ++u) {
+        double cumulative = 0.0;
+
+        // the grid point is the start of its interval, the last one is the end of the previous
+        std::size_t index = std::min(u, union_energy.size() - 2);
+        double t = static_cast<double>(u - index);
+
+        for (std::size_t i = 0; i < count; ++i) {
+            double elem_xs = get_element(mat.elements[i]).get_all_cross_sections(index, t).total;
+
+            cumulative += elem_xs * mat.atom_density[i];
+            mat.macro_xs_cumulative[u * count + i] = cumulative;
+        }
+    }
+}
+
 parsed_material parse_material_string(const std::string_view &material) {
 
     parsed_material parsed;
@@ -12,68 +12,102 @@ double &particle::energy() { return history.energies.back(); }
 
 vec3 &particle::position() { return history.points.back(); }
 
-void particle::photon_interaction(const element &element) {
+particle_step particle::step(std::size_t index) const {
+    return {.start = history.points[index - 1],
+            .end = history.points[index],
+            .energy = history.energies[index - 1],
+            .end_energy = history.energies[index],
+            .interaction = history.interactions[index],
+            .element = history.elements[index],
+            .object = history.objects[index],
+            .generation = history.generations[index]};
+}
 
-    sampled_xs xs_data = element.get_all_cross_sections(energy());
+particle_step particle::last_step() const { return step(history.points.size() - 1); }
 
-    double prob = 0.0;
-    double sample = prng_double(prng_state) * xs_data.total;
+void particle::photon_interaction(const element &element, const sampled_xs &xs) {
 
     history.elements.back() = element.atomic_number;
 
+    history.interactions.back() =
+        sample_photon_interaction(element, xs, energy(), direction, prng_state);
+}
+
+void particle::advance(double distance, std::size_t object) {
+
+    // each interaction starts a new generation of the particle
+    std::size_t generation = history.generations.back();
+    if (history.interactions.back() != cross_section::no_interaction) {
+        generation++;
+    }
+
+    // the previous step was already scored, keep only the current state
+    if (!record_history && history.points.size() > 1) {
+        history.points.erase(history.points.begin());
+        history.energies.erase(history.energies.begin());
+        history.interactions.erase(history.interactions.begin());
+        history.elements.erase(history.elements.begin());
+        history.objects.erase(history.objects.begin());
+        history.generations.erase(history.generations.begin());
+    }
+
+    history.energies.push_back(energy());
+    history.interactions.push_back(cross_section::no_interaction);
+    history.elements.push_back(0);
+    history.objects.push_back(object);
+    history.generations.push_back(generation);
+
+    vec3 new_position = position() + distance * direction;
+
+    history.points.push_back(new_position);
+}
+
+cross_section sample_photon_interaction(const element &element, const sampled_xs &xs_data,
+                                        double &energy, vec3 &direction, uint64_t &prng_state) {
+
+    double prob = 0.0;
+    double sample = prng_double(prng_state) * xs_data.total;
+
     prob += xs_data.coherent;
     if (sample < prob) {
 
-        double mu = element.rayleigh(energy(), prng_state);
+        double mu = element.rayleigh(energy, prng_state);
 
         // sample phi for direction rotation
         double phi = 2.0 * constants::pi * prng_double(prng_state);
 
         direction = rotate_direction(direction, mu, phi);
 
-        history.interactions.back() = cross_section::coherent;
-        return;
+        return cross_section::coherent;
     }
 
     prob += xs_data.incoherent;
     if (sample < prob) {
 
-        auto [new_energy, mu] = element.compton(energy(), prng_state);
+        auto [new_energy, mu] = element.compton(energy, prng_state);
 
-        energy() = new_energy;
+        energy = new_energy;
 
         double phi = 2.0 * constants::pi * prng_double(prng_state);
 
         direction = rotate_direction(direction, mu, phi);
 
-        history.interactions.back() = cross_section::incoherent;
-        return;
+        return cross_section::incoherent;
     }
 
     prob += xs_data.photoelectric;
     if (sample < prob) {
-        energy() = 0.0;
-        history.interactions.back() = cross_section::photoelectric;
-        return;
+        energy = 0.0;
+        return cross_section::photoelectric;
     }
 
     prob += xs_data.pair_production;
     if (sample < prob) {
-        energy() = 0.0;
-        history.interactions.back() = cross_section::pair_production;
-        return;
+        energy = 0.0;
+        return cross_section::pair_production;
     }
-}
 
-void particle::advance(double distance) {
-
-    history.energies.push_back(energy());
-    history.interactions.push_back(cross_section::no_interaction);
-    history.elements.push_back(0);
-
-    vec3 new_position = position() + distance * direction;
-
-    history.points.push_back(new_position);
+    return cross_section::no_interaction;
 }
 
 } // namespace projector
\ No newline at end of file
@@ -55,20 +55,31 @@ void env_slice_plot(const environment &env, const char plane, double center,
         throw std::runtime_error("invalid slice plane!");
     }
 
+    // pixels are evaluated in rows, as a packet of points
+    std::vector<double> row_x(res_x), row_y(res_x), row_z(res_x);
+    std::vector<const object *> row_objects(res_x);
+    object_lookup_scratch scratch;
+
     for (std::size_t y = 0; y < res_y; ++y) {
         for (std::size_t x = 0; x < res_x; ++x) {
             vec3 position = x * x_increment + y * y_increment + constant_axis;
+            row_x[x] = position[0];
+            row_y[x] = position[1];
+            row_z[x] = position[2];
+        }
+
+        ray_packet row = {row_x.data(), row_y.data(), row_z.data(), nullptr, nullptr, nullptr,
+                          res_x};
+        env.find_objects(row, row_objects.data(), scratch);
+
+        for (std::size_t x = 0; x < res_x; ++x) {
             std::string object = "no_object";
             std::string material = "void";
-            //backwards search objects
-            for (int i = env.objects.size() - 1; i >= 0; --i) {
-                if (env.objects[i].geom.point_inside(position)) {
-                    object = env.objects[i].id;
-                    material = env.material_ids[env.objects[i].material_id];
-                    break;
-                }
+            if (const auto *obj = row_objects[x]) {
+                object = obj->id;
+                material = env.material_ids[obj->material_id];
             }
-            output_file << position[0] << "," << position[1] << "," << position[2] << ",";
+            output_file << row_x[x] << "," << row_y[x] << "," << row_z[x] << ",";
             output_file << material << "," << object << "\n";
         }
     }
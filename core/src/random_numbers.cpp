@@ -32,6 +32,33 @@ void seed_master_prng(uint64_t seed) { master_seed = seed; }
 
 uint64_t generate_prng_seed() { return advance_prng(master_seed); }
 
+void skip_prng(uint64_t &state, uint64_t delta) {
+    // LCG jump ahead, see F. Brown, "Random number generation with arbitrary strides"
+    // the multiplier and increment of the combined step are built by repeated squaring
+    uint64_t acc_mult = 1u;
+    uint64_t acc_add = 0u;
+    uint64_t cur_mult = prng_mult;
+    uint64_t cur_add = prng_add;
+
+    while (delta > 0) {
+        if (delta & 1u) {
+            acc_mult *= cur_mult;
+            acc_add = acc_add * cur_mult + cur_add;
+        }
+        cur_add = (cur_mult + 1u) * cur_add;
+        cur_mult *= cur_mult;
+        delta >>= 1u;
+    }
+
+    state = acc_mult * state + acc_add;
+}
+
+uint64_t prng_stream_state(uint64_t seed, uint64_t index) {
+    uint64_t state = seed;
+    skip_prng(state, index * prng_stream_stride);
+    return state;
+}
+
 double prng_double(uint64_t &state) {
 
     uint64_t output = advance_prng(state);
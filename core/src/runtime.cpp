@@ -3,8 +3,11 @@
 #include "constants.hpp"
 #include "random_numbers.hpp"
 
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <nlohmann/json.hpp>
 #include <omp.h>
 #include <stdio.h>
 
@@ -12,45 +15,68 @@ int thread_count = 1;
 
 namespace {
 
-projector::object *get_current_obj(std::vector<projector::object> &objs,
-                                   projector::vec3 current_pos) {
-    projector::object *found = nullptr;
+void score_last_step(projector::environment &env, const projector::particle &p) {
+    env.scorer.score_step(p.last_step());
+}
+
+// simulate a single particle from its source point until it ends
+void transport_particle(projector::environment &env, projector::particle &p) {
+    using namespace projector;
+
+    const object *current_obj = env.find_object(p.position());
 
-    // go backwards in search
-    for (int i = objs.size() - 1; i >= 0; --i) {
-        if (objs[i].geom.point_inside(current_pos)) {
-            found = &objs[i];
+    for (std::size_t i = 0; i < env.stack_size; ++i) {
+        // check for energy cutoff
+        if (p.energy() <= env.energy_cutoff) {
             break;
         }
-    }
 
-    return found;
-}
+        // check for bounds
+        if (!env.bounds.point_inside(p.position())) {
+            break;
+        }
+
+        // move to nearest surface if we are not in any object
+        if (current_obj == nullptr) {
+            double dist = env.nearest_object_distance(p.position(), p.direction);
+            p.advance(dist + 5 * constants::epsilon, no_object);
+            current_obj = env.find_object(p.position());
+            score_last_step(env, p);
+            continue;
+        }
 
-double nearest_global_distance(projector::environment &env, projector::particle &p) {
+        auto [material_total_macro_xs, elem, elem_xs] = env.cross_section_data.sample_material(
+            env.materials[current_obj->material_id], p.energy(), p.prng_state, p.xs_cache);
 
-    double bb_distance = projector::constants::infinity;
-    double surface_distance = projector::constants::infinity;
+        double surface_distance =
+            current_obj->geom.nearest_surface_distance(p.position(), p.direction);
 
-    // this currently goes through all objects and if we find new nearest BB, we check the surface
-    // distance and take it if it is nearer than the previous surface distance
-    // it possibly generates false data, need to check/test later
-    for (auto &obj : env.objects) {
-        double temp_dist = obj.geom.bb.distance_along_line(p.position(), p.direction);
+        double interaction_dist =
+            -std::log(prng_double(p.prng_state)) / (material_total_macro_xs * 10.0e-24);
 
+        std::size_t obj_index = env.object_index(current_obj);
 
-        if (temp_dist < bb_distance) {
-            double s_dist = obj.geom.nearest_surface_distance(p.position(), p.direction);
-            surface_distance = std::min(surface_distance, s_dist);
-            bb_distance = temp_dist;
+        // we also need to check whether we dont go out of the bounds
+        double env_distance = env.bounds.distance_along_line(p.position(), p.direction);
+
+        if (env_distance < surface_distance && env_distance < interaction_dist) {
+            p.advance(env_distance + 5 * constants::epsilon, obj_index);
         }
-    }
 
-    if (surface_distance == projector::constants::infinity) {
-        return env.bounds.distance_along_line(p.position(), p.direction);
-    }
+        else if (interaction_dist < surface_distance) {
+            p.advance(interaction_dist, obj_index);
 
-    return surface_distance;
+            p.photon_interaction(*elem, elem_xs);
+
+        } else {
+            // move tiny bit behind the surface, to not get stuck on it
+            p.advance(surface_distance + 5 * constants::epsilon, obj_index);
+            current_obj = env.find_object(p.position());
+        }
+
+        // tallies are scored on the fly, so the history does not need to be kept
+        score_last_step(env, p);
+    }
 }
 
 } // namespace
@@ -58,6 +84,36 @@ double nearest_global_distance(projector::environment &env, projector::particle
 namespace projector {
 
 
+void sample_source_particle(const environment &env, std::size_t index, particle &p) {
+
+    auto found = std::upper_bound(env.source_offsets.begin(), env.source_offsets.end(), index);
+    const object &obj = env.objects[std::distance(env.source_offsets.begin(), found)];
+
+    p.particle_type = particle::type::photon;
+    p.prng_state = prng_stream_state(env.seed, index);
+    p.record_history = env.save_particle_paths;
+    p.xs_cache.clear();
+
+    double mu = obj.photons_spread + prng_double(p.prng_state) * (1.0 - obj.photons_spread);
+    double phi = prng_double(p.prng_state) * 2.0 * constants::pi;
+    p.direction = rotate_direction(obj.photons_dir, mu, phi);
+
+    // reuse the history storage of the particle
+    p.history.points.clear();
+    p.history.energies.clear();
+    p.history.interactions.clear();
+    p.history.elements.clear();
+    p.history.objects.clear();
+    p.history.generations.clear();
+
+    p.history.elements.push_back(0);
+    p.history.objects.push_back(no_object);
+    p.history.generations.push_back(0);
+    p.history.energies.push_back(obj.photons_energy);
+    p.history.interactions.push_back(cross_section::no_interaction);
+    p.history.points.push_back(obj.geom.sample_point(p.prng_state));
+}
+
 void initialize_runtime(environment &env, int max_threads) {
     thread_count = max_threads;
 
@@ -65,130 +121,164 @@ void initialize_runtime(environment &env, int max_threads) {
 
     seed_master_prng(env.seed);
 
-    // sample objects and create particles
-    for (object &obj : env.objects) {
+    env.total_particles = 0;
+    env.sourced_particles = 0;
+    env.batch_count = 0;
+    env.xs_cache_hits = 0;
+    env.xs_cache_misses = 0;
+
+    env.source_offsets.clear();
+
+    for (const object &obj : env.objects) {
+        env.total_particles += obj.photons_activity;
+        env.source_offsets.push_back(env.total_particles);
+    }
+
+    for (auto &tally : env.tallies) {
+        tally->init_tally();
+    }
 
-        uint64_t prng_local = generate_prng_seed();
+    env.scorer = tally_scorer(env.tallies, env.filters);
+}
 
-        for (std::size_t i = 0; i < obj.photons_activity; ++i) {
+bool source_batch(environment &env) {
 
-            double mu = obj.photons_spread + prng_double(prng_local) * (1.0 - obj.photons_spread);
-            double phi = prng_double(prng_local) * 2.0 * constants::pi;
-            vec3 direction = rotate_direction(obj.photons_dir, mu, phi);
+    std::size_t remaining = env.total_particles - env.sourced_particles;
 
+    if (remaining == 0) {
+        return false;
+    }
 
-            particle p = {.particle_type = particle::type::photon,
-                          .direction = direction,
-                          .prng_state = generate_prng_seed()};
-            p.history.elements.push_back(0);
-            p.history.energies.push_back(obj.photons_energy);
-            p.history.interactions.push_back(cross_section::no_interaction);
-            p.history.points.push_back(obj.geom.sample_point(prng_local));
+    std::size_t count = env.batch_size == 0 ? remaining : std::min(env.batch_size, remaining);
 
-            env.particles.push_back(p);
-        }
+    // the particles are sampled lazily by the transport, only keep them if we save them
+    if (env.save_particle_paths) {
+        env.particles.resize(count);
     }
 
+    env.batch_start = env.sourced_particles;
+    env.batch_particles = count;
+    env.sourced_particles += count;
+
+    return true;
+}
+
+void flush_tallies(environment &env) {
     for (auto &tally : env.tallies) {
-        tally->init_tally();
+        tally->flush_scores();
     }
 }
 
 void calculate_particle_histories(environment &env) {
 
-    std::size_t counter = 0;
+    // the batch is transported in passes, the tallies are flushed after each of them
+    for (std::size_t first = 0; first < env.batch_particles; first += env.tally_flush_particles) {
+        std::size_t last = std::min(env.batch_particles, first + env.tally_flush_particles);
 
-    // simulate each particle separately
-    #pragma omp parallel for
-    for (particle &p : env.particles) {
+        // simulate each particle separately, the particle is sampled by the thread simulating it
+        #pragma omp parallel
+        {
+            particle p;
 
-        object *current_obj = get_current_obj(env.objects, p.position());
+            std::size_t cache_hits = 0;
+            std::size_t cache_misses = 0;
 
-        for (std::size_t i = 0; i < env.stack_size; ++i) {
-            // check for energy cutoff
-            if (p.energy() <= env.energy_cutoff) {
-                break;
-            }
+            #pragma omp for
+            for (std::size_t index = first; index < last; ++index) {
 
-            // check for bounds
-            if (!env.bounds.point_inside(p.position())) {
-                break;
-            }
-
-            // move to nearest surface if we are not in any object
-            if (current_obj == nullptr) {
-                double dist = nearest_global_distance(env, p);
-                p.advance(dist + 5 * constants::epsilon);
-                current_obj = get_current_obj(env.objects, p.position());
-                continue;
-            }
+                sample_source_particle(env, env.batch_start + index, p);
 
-            auto [material_total_macro_xs, elem] = env.cross_section_data.sample_material(
-                env.materials[current_obj->material_id], p.energy(), p.prng_state);
+                p.xs_cache.hits = 0;
+                p.xs_cache.misses = 0;
 
-            double surface_distance =
-                current_obj->geom.nearest_surface_distance(p.position(), p.direction);
+                transport_particle(env, p);
 
-            double interaction_dist =
-                -std::log(prng_double(p.prng_state)) / (material_total_macro_xs * 10.0e-24);
+                cache_hits += p.xs_cache.hits;
+                cache_misses += p.xs_cache.misses;
 
-            // we also need to check whether we dont go out of the bounds
-            double env_distance = env.bounds.distance_along_line(p.position(), p.direction);
-
-            if (env_distance < surface_distance && env_distance < interaction_dist) {
-                p.advance(env_distance + 5 * constants::epsilon);
+                if (env.save_particle_paths) {
+                    env.particles[index] = std::move(p);
+                }
             }
 
-            else if (interaction_dist < surface_distance) {
-                p.advance(interaction_dist);
-
-                p.photon_interaction(elem);
+            #pragma omp atomic
+            env.xs_cache_hits += cache_hits;
 
-            } else {
-                // move tiny bit behind the surface, to not get stuck on it
-                p.advance(surface_distance + 5 * constants::epsilon);
-                current_obj = get_current_obj(env.objects, p.position());
-            }
+            #pragma omp atomic
+            env.xs_cache_misses += cache_misses;
         }
 
-        counter++;
+        flush_tallies(env);
     }
 }
 
 void process_tallies(environment &env) {
 
+    // particle steps are already scored during transport, only finalize
     for (auto &tally : env.tallies) {
-        #pragma omp parallel for
-        for (auto &particle : env.particles) {
-            tally->add_particle(particle);
-        }
-
         tally->finalize_data();
     }
 }
 
-void save_data(environment &env) {
+bool finish_batch(environment &env) {
 
-    std::filesystem::create_directories(env.output_path / "tallies");
+    env.batch_count++;
 
-    for (auto &tally : env.tallies) {
-        tally->save_tally(env.output_path / "tallies");
+    // a single batch run has no batch statistics
+    if (env.batch_size != 0 && env.batch_size < env.total_particles) {
+        for (auto &tally : env.tallies) {
+            tally->end_batch(env.batch_particles);
+        }
     }
 
-    // check if we can skip saving particle data
-    if (!env.save_particle_paths) {
-        return;
+    if (env.save_particle_paths) {
+        std::filesystem::create_directories(env.output_path / "tracks");
+
+        for (std::size_t i = 0; i < env.particles.size(); ++i) {
+            char file_path[256] = {0};
+
+            snprintf(file_path, 256, "photon_%09zu.csv", env.batch_start + i);
+
+            env.particles[i].save_particle(env.output_path / "tracks" / file_path);
+        }
     }
 
-    for (std::size_t i = 0; i < env.particles.size(); ++i) {
-        char file_path[256] = {0};
+    env.particles.clear();
+    env.particles.shrink_to_fit();
 
-        snprintf(file_path, 256, "photon_%09zu.csv", i);
+    if (env.target_relative_error <= 0.0) {
+        return false;
+    }
 
-        std::filesystem::create_directories(env.output_path / "tracks");
+    double max_error = 0.0;
 
-        env.particles[i].save_particle(env.output_path / "tracks" / file_path);
+    for (std::size_t index : env.convergence_tallies) {
+        max_error = std::max(max_error,
+                             env.tallies[index]->relative_error(env.convergence_score_fraction));
     }
+
+    std::cout << "Batch " << env.batch_count << " done, " << env.sourced_particles << "/"
+              << env.total_particles << " particles, relative error: " << max_error << std::endl;
+
+    return max_error <= env.target_relative_error;
+}
+
+void save_data(environment &env) {
+
+    std::filesystem::create_directories(env.output_path / "tallies");
+
+    for (auto &tally : env.tallies) {
+        tally->save_tally(env.output_path / "tallies");
+    }
+
+    // the tallies are totals over the sourced particles, fewer than configured when the target
+    // relative error stopped the run early
+    nlohmann::json run = {{"name", env.name},
+                          {"total_particles", env.total_particles},
+                          {"sourced_particles", env.sourced_particles},
+                          {"batch_count", env.batch_count}};
+
+    std::ofstream(env.output_path / "run.json") << run.dump(4) << std::endl;
 }
 
 } // namespace projector
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "surface.hpp"
 
 #include "constants.hpp"
+#include "csg_program.hpp"
 
 #include <cmath>
 
@@ -9,64 +10,32 @@ namespace {
 using pvec3 = projector::vec3;
 
 //=======================================
-// Generic functions to evaluate surfaces in this form:
+// Axis aligned surfaces are stored in this form, relative to the center:
 //
 //  S_x * (x^2 / a^2) + S_y * (y^2 / b^2) + S_z * (z^2 / c^2) = R
 //
+// the scales S_i / a_i^2 are computed once, when the surface is constructed
 //=======================================
 
 template <int S_x, int S_y, int S_z, int R>
-double generic_eval(const pvec3 &p, double a, double b, double c) {
-    double x = (S_x * p.x() * p.x()) / (a * a);
-    double y = (S_y * p.y() * p.y()) / (b * b);
-    double z = (S_z * p.z() * p.z()) / (c * c);
-
-    return (x + y + z) < R;
+projector::axis_quadric_coeffs generic_coeffs(const pvec3 &center, double a, double b, double c) {
+    return {center, {S_x / (a * a), S_y / (b * b), S_z / (c * c)}, static_cast<double>(R)};
 }
 
+double generic_dist(const projector::axis_quadric_coeffs &coeffs, const pvec3 &p,
+                    const pvec3 &d) {
+    pvec3 shifted = p - coeffs.center;
 
-template <int S_x, int S_y, int S_z, int R>
-double generic_dist(const pvec3 &p, const pvec3 &d, double a, double b,
-                    double c) {
-
-    double e = S_x * std::pow(b * c * d.x(), 2) +
-               S_y * std::pow(a * c * d.y(), 2) +
-               S_z * std::pow(a * b * d.z(), 2);
-
-    double f = S_x * std::pow(b * c, 2) * 2 * p.x() * d.x() +
-               S_y * std::pow(a * c, 2) * 2 * p.y() * d.y() +
-               S_z * std::pow(a * b, 2) * 2 * p.z() * d.z();
-
-    double g = S_x * std::pow(b * c * p.x(), 2) +
-               S_y * std::pow(a * c * p.y(), 2) +
-               S_z * std::pow(a * b * p.z(), 2) - R * std::pow(a * b * c, 2);
-
-    // we now have e * t^2 + f * t + g = 0, solve it via discriminant
-
-    // if e is zero, we never intersect the surface
-    if (e == 0.0) {
-        return projector::constants::infinity;
-    }
-
-    double discriminant = f * f - 4 * e * g;
-
-    // if the discriminant is negative, we have only complex roots and
-    // no intersect
-    if (discriminant < 0.0) {
-        return projector::constants::infinity;
-    }
-
-    double dist1 = (-f + std::sqrt(discriminant)) / (2 * e);
-    double dist2 = (-f - std::sqrt(discriminant)) / (2 * e);
+    return projector::axis_quadric_distance(shifted.x(), shifted.y(), shifted.z(), d.x(), d.y(),
+                                            d.z(), coeffs.scale.x(), coeffs.scale.y(),
+                                            coeffs.scale.z(), coeffs.r);
+}
 
-    // if both solutions are positive, return the smaller one
-    if (dist1 > 0.0 && dist2 > 0.0) {
-        return std::min(dist1, dist2);
-    }
+bool generic_eval(const projector::axis_quadric_coeffs &coeffs, const pvec3 &p) {
+    pvec3 shifted = p - coeffs.center;
 
-    // we have one positive and one negative solution, return the positive
-    // or we have two negative, same situation
-    return std::max(dist1, dist2);
+    return projector::axis_quadric_value(shifted.x(), shifted.y(), shifted.z(), coeffs.scale.x(),
+                                         coeffs.scale.y(), coeffs.scale.z(), coeffs.r) < 0.0;
 }
 
 } // namespace
@@ -125,29 +94,38 @@ std::pair<vec3, vec3> plane::bounding_box() const {
     return {{-inf, -inf, -inf}, {inf, inf, inf}};
 }
 
-double ellipsoid::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    // shift the point so that the ellipsoid is at zero
-    vec3 shifted = p - center;
+void plane::compile(csg_program &program) const {
+    program.add_plane({point, normal});
+}
+
+ellipsoid::ellipsoid(vec3 center, double a, double b, double c)
+    : center(center), radii({a, b, c}), coeffs(generic_coeffs<1, 1, 1, 1>(center, a, b, c)) {}
 
-    return generic_dist<1, 1, 1, 1>(shifted, dir, radii[0], radii[1], radii[2]);
+double ellipsoid::distance_along_line(const vec3 &p, const vec3 &dir) const {
+    return generic_dist(coeffs, p, dir);
 }
 
 bool ellipsoid::point_inside(const vec3 &p) const {
-    vec3 shifted = p - center;
-
-    return generic_eval<1, 1, 1, 1>(shifted, radii[0], radii[1], radii[2]);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> ellipsoid::bounding_box() const {
     return {center - radii, center + radii};
 }
 
+void ellipsoid::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+x_cone::x_cone(vec3 center, double a, double b, double c)
+    : center(center), a(a), b(b), c(c), coeffs(generic_coeffs<-1, 1, 1, 0>(center, a, b, c)) {}
+
 double x_cone::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<-1, 1, 1, 0>(p - center, dir, a, b, c);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool x_cone::point_inside(const vec3 &p) const {
-    return generic_eval<-1, 1, 1, 0>(p - center, a, b, c);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> x_cone::bounding_box() const {
@@ -156,12 +134,19 @@ std::pair<vec3, vec3> x_cone::bounding_box() const {
             {constants::infinity, constants::infinity, constants::infinity}};
 }
 
+void x_cone::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+y_cone::y_cone(vec3 center, double a, double b, double c)
+    : center(center), a(a), b(b), c(c), coeffs(generic_coeffs<1, -1, 1, 0>(center, a, b, c)) {}
+
 double y_cone::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<1, -1, 1, 0>(p - center, dir, a, b, c);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool y_cone::point_inside(const vec3 &p) const {
-    return generic_eval<1, -1, 1, 0>(p - center, a, b, c);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> y_cone::bounding_box() const {
@@ -170,12 +155,19 @@ std::pair<vec3, vec3> y_cone::bounding_box() const {
             {constants::infinity, constants::infinity, constants::infinity}};
 }
 
+void y_cone::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+z_cone::z_cone(vec3 center, double a, double b, double c)
+    : center(center), a(a), b(b), c(c), coeffs(generic_coeffs<1, 1, -1, 0>(center, a, b, c)) {}
+
 double z_cone::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<1, 1, -1, 0>(p - center, dir, a, b, c);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool z_cone::point_inside(const vec3 &p) const {
-    return generic_eval<1, 1, -1, 0>(p - center, a, b, c);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> z_cone::bounding_box() const {
@@ -184,12 +176,19 @@ std::pair<vec3, vec3> z_cone::bounding_box() const {
             {constants::infinity, constants::infinity, constants::infinity}};
 }
 
+void z_cone::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+x_cylinder::x_cylinder(vec3 center, double a, double b)
+    : center(center), a(a), b(b), coeffs(generic_coeffs<0, 1, 1, 1>(center, 1, a, b)) {}
+
 double x_cylinder::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<0, 1, 1, 1>(p - center, dir, 1, a, b);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool x_cylinder::point_inside(const vec3 &p) const {
-    return generic_eval<0, 1, 1, 1>(p - center, 1, a, b);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> x_cylinder::bounding_box() const {
@@ -197,25 +196,39 @@ std::pair<vec3, vec3> x_cylinder::bounding_box() const {
             {constants::infinity, center.y() + a, center.z() + b}};
 }
 
+void x_cylinder::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+y_cylinder::y_cylinder(vec3 center, double a, double b)
+    : center(center), a(a), b(b), coeffs(generic_coeffs<1, 0, 1, 1>(center, a, 1, b)) {}
+
 double y_cylinder::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<1, 0, 1, 1>(p - center, dir, a, 1, b);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool y_cylinder::point_inside(const vec3 &p) const {
-    return generic_eval<1, 0, 1, 1>(p - center, a, 1, b);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> y_cylinder::bounding_box() const {
     return {{center.x() - a, -constants::infinity, center.z() - b},
-            {center.x() + b, constants::infinity, center.z() + b}};
+            {center.x() + a, constants::infinity, center.z() + b}};
 }
 
+void y_cylinder::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+z_cylinder::z_cylinder(vec3 center, double a, double b)
+    : center(center), a(a), b(b), coeffs(generic_coeffs<1, 1, 0, 1>(center, a, b, 1)) {}
+
 double z_cylinder::distance_along_line(const vec3 &p, const vec3 &dir) const {
-    return generic_dist<1, 1, 0, 1>(p - center, dir, a, b, 1);
+    return generic_dist(coeffs, p, dir);
 }
 
 bool z_cylinder::point_inside(const vec3 &p) const {
-    return generic_eval<1, 1, 0, 1>(p - center, a, b, 1);
+    return generic_eval(coeffs, p);
 }
 
 std::pair<vec3, vec3> z_cylinder::bounding_box() const {
@@ -223,4 +236,49 @@ std::pair<vec3, vec3> z_cylinder::bounding_box() const {
             {center.x() + a, center.y() + b, constants::infinity}};
 }
 
+void z_cylinder::compile(csg_program &program) const {
+    program.add_axis_quadric(coeffs);
+}
+
+double box::distance_along_line(const vec3 &p, const vec3 &dir) const {
+    auto [entry, exit] = slab_intersect(min, max, p, dir.cwiseInverse());
+
+    return box_distance(entry, exit);
+}
+
+bool box::point_inside(const vec3 &p) const {
+    return (p.array() > min.array()).all() && (p.array() < max.array()).all();
+}
+
+std::pair<vec3, vec3> box::bounding_box() const {
+    return {min, max};
+}
+
+void box::compile(csg_program &program) const {
+    program.add_box(min, max);
+}
+
+double quadric::distance_along_line(const vec3 &p, const vec3 &dir) const {
+    vec3 shifted = p - coeffs.center;
+
+    return quadric_distance(shifted.x(), shifted.y(), shifted.z(), dir.x(), dir.y(), dir.z(),
+                            coeffs.k);
+}
+
+bool quadric::point_inside(const vec3 &p) const {
+    vec3 shifted = p - coeffs.center;
+
+    return quadric_value(shifted.x(), shifted.y(), shifted.z(), coeffs.k) < 0.0;
+}
+
+std::pair<vec3, vec3> quadric::bounding_box() const {
+    // general quadric cannot be bounded
+    return {{-constants::infinity, -constants::infinity, -constants::infinity},
+            {constants::infinity, constants::infinity, constants::infinity}};
+}
+
+void quadric::compile(csg_program &program) const {
+    program.add_quadric(coeffs);
+}
+
 } // namespace projector
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "surface_kernels.hpp"
+
+// The kernels are plain loops over arrays, vectorized by the compiler. The instruction set is
+// selected at build time (PROJECTOR_NATIVE_ARCH), without it they compile to the baseline
+// instructions of the target.
+
+namespace {
+
+constexpr double inf = projector::constants::infinity;
+
+/// Coefficients of the quadric with given index, the same for all rays of a packet
+std::array<double, 10> quadric_coefficients(const projector::quadric_set &quadrics,
+                                            std::size_t i) {
+    std::array<double, 10> k;
+    for (std::size_t c = 0; c < k.size(); ++c) {
+        k[c] = quadrics.k[c][i];
+    }
+    return k;
+}
+
+} // namespace
+
+namespace projector {
+
+void plane_set::push_back(const plane_coeffs &plane) {
+    x.push_back(plane.point.x());
+    y.push_back(plane.point.y());
+    z.push_back(plane.point.z());
+    nx.push_back(plane.normal.x());
+    ny.push_back(plane.normal.y());
+    nz.push_back(plane.normal.z());
+}
+
+void axis_quadric_set::push_back(const axis_quadric_coeffs &quadric) {
+    x.push_back(quadric.center.x());
+    y.push_back(quadric.center.y());
+    z.push_back(quadric.center.z());
+    sx.push_back(quadric.scale.x());
+    sy.push_back(quadric.scale.y());
+    sz.push_back(quadric.scale.z());
+    r.push_back(quadric.r);
+}
+
+void box_set::push_back(const vec3 &min, const vec3 &max) {
+    min_x.push_back(min.x());
+    min_y.push_back(min.y());
+    min_z.push_back(min.z());
+    max_x.push_back(max.x());
+    max_y.push_back(max.y());
+    max_z.push_back(max.z());
+}
+
+void quadric_set::push_back(const quadric_coeffs &quadric) {
+    x.push_back(quadric.center.x());
+    y.push_back(quadric.center.y());
+    z.push_back(quadric.center.z());
+    for (std::size_t c = 0; c < k.size(); ++c) {
+        k[c].push_back(quadric.k[c]);
+    }
+}
+
+ray_packet ray_packet::slice(std::size_t first, std::size_t count) const {
+    auto offset = [first](const double *values) { return values ? values + first : nullptr; };
+
+    return {x + first, y + first, z + first, offset(u), offset(v), offset(w),
+            count, offset(inv_u), offset(inv_v), offset(inv_w)};
+}
+
+double nearest_plane_distance(const plane_set &planes, const vec3 &p, const vec3 &dir) {
+    const double *x = planes.x.data(), *y = planes.y.data(), *z = planes.z.data();
+    const double *nx = planes.nx.data(), *ny = planes.ny.data(), *nz = planes.nz.data();
+
+    double px = p.x(), py = p.y(), pz = p.z();
+    double u = dir.x(), v = dir.y(), w = dir.z();
+
+    double nearest = inf;
+
+    #pragma omp simd reduction(min : nearest)
+    for (std::size_t i = 0; i < planes.size(); ++i) {
+        double offset = (px - x[i]) * nx[i] + (py - y[i]) * ny[i] + (pz - z[i]) * nz[i];
+        double dist = plane_distance(offset, u * nx[i] + v * ny[i] + w * nz[i]);
+
+        nearest = (dist >= 0.0 && dist < nearest) ? dist : nearest;
+    }
+
+    return nearest;
+}
+
+double nearest_axis_quadric_distance(const axis_quadric_set &quadrics, const vec3 &p,
+                                     const vec3 &dir) {
+    const double *x = quadrics.x.data(), *y = quadrics.y.data(), *z = quadrics.z.data();
+    const double *sx = quadrics.sx.data(), *sy = quadrics.sy.data(), *sz = quadrics.sz.data();
+    const double *r = quadrics.r.data();
+
+    double px = p.x(), py = p.y(), pz = p.z();
+    double u = dir.x(), v = dir.y(), w = dir.z();
+
+    double nearest = inf;
+
+    #pragma omp simd reduction(min : nearest)
+    for (std::size_t i = 0; i < quadrics.size(); ++i) {
+        double dist = axis_quadric_distance(px - x[i], py - y[i], pz - z[i], u, v, w, sx[i], sy[i],
+                                            sz[i], r[i]);
+
+        nearest = (dist >= 0.0 && dist < nearest) ? dist : nearest;
+    }
+
+    return nearest;
+}
+
+double nearest_quadric_distance(const quadric_set &quadrics, const vec3 &p, const vec3 &dir) {
+    double nearest = inf;
+
+    // general quadrics are rare, a plain loop is enough here
+    for (std::size_t i = 0; i < quadrics.size(); ++i) {
+        double dist = quadric_distance(p.x() - quadrics.x[i], p.y() - quadrics.y[i],
+                                       p.z() - quadrics.z[i], dir.x(), dir.y(), dir.z(),
+                                       quadric_coefficients(quadrics, i));
+
+        nearest = (dist >= 0.0 && dist < nearest) ? dist : nearest;
+    }
+
+    return nearest;
+}
+
+double nearest_box_distance(const box_set &boxes, const vec3 &p, const vec3 &dir) {
+    const double *min_x = boxes.min_x.data(), *min_y = boxes.min_y.data();
+    const double *min_z = boxes.min_z.data(), *max_x = boxes.max_x.data();
+    const double *max_y = boxes.max_y.data(), *max_z = boxes.max_z.data();
+
+    double px = p.x(), py = p.y(), pz = p.z();
+
+    // the inverted direction is shared by all boxes
+    double inv_u = 1.0 / dir.x(), inv_v = 1.0 / dir.y(), inv_w = 1.0 / dir.z();
+
+    double nearest = inf;
+
+    #pragma omp simd reduction(min : nearest)
+    for (std::size_t i = 0; i < boxes.size(); ++i) {
+        double entry = -inf, exit = inf;
+        slab_axis(px, inv_u, min_x[i], max_x[i], entry, exit);
+        slab_axis(py, inv_v, min_y[i], max_y[i], entry, exit);
+        slab_axis(pz, inv_w, min_z[i], max_z[i], entry, exit);
+
+        double dist = box_distance(entry, exit);
+
+        nearest = dist < nearest ? dist : nearest;
+    }
+
+    return nearest;
+}
+
+void plane_inside(const plane_set &planes, std::size_t i, const ray_packet &rays,
+                  uint8_t *inside) {
+    double x = planes.x[i], y = planes.y[i], z = planes.z[i];
+    double nx = planes.nx[i], ny = planes.ny[i], nz = planes.nz[i];
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        inside[j] = (rays.x[j] - x) * nx + (rays.y[j] - y) * ny + (rays.z[j] - z) * nz < 0.0;
+    }
+}
+
+void axis_quadric_inside(const axis_quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                         uint8_t *inside) {
+    double x = quadrics.x[i], y = quadrics.y[i], z = quadrics.z[i];
+    double sx = quadrics.sx[i], sy = quadrics.sy[i], sz = quadrics.sz[i];
+    double r = quadrics.r[i];
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        inside[j] =
+            axis_quadric_value(rays.x[j] - x, rays.y[j] - y, rays.z[j] - z, sx, sy, sz, r) < 0.0;
+    }
+}
+
+void box_inside(const box_set &boxes, std::size_t i, const ray_packet &rays, uint8_t *inside) {
+    double min_x = boxes.min_x[i], min_y = boxes.min_y[i], min_z = boxes.min_z[i];
+    double max_x = boxes.max_x[i], max_y = boxes.max_y[i], max_z = boxes.max_z[i];
+
+    const double *px = rays.x, *py = rays.y, *pz = rays.z;
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        inside[j] = (px[j] > min_x) & (px[j] < max_x) & (py[j] > min_y) & (py[j] < max_y) &
+                    (pz[j] > min_z) & (pz[j] < max_z);
+    }
+}
+
+void quadric_inside(const quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                    uint8_t *inside) {
+    double x = quadrics.x[i], y = quadrics.y[i], z = quadrics.z[i];
+    auto k = quadric_coefficients(quadrics, i);
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        inside[j] = quadric_value(rays.x[j] - x, rays.y[j] - y, rays.z[j] - z, k) < 0.0;
+    }
+}
+
+void nearest_plane_distance(const plane_set &planes, std::size_t i, const ray_packet &rays,
+                            double *nearest) {
+    double x = planes.x[i], y = planes.y[i], z = planes.z[i];
+    double nx = planes.nx[i], ny = planes.ny[i], nz = planes.nz[i];
+
+    const double *px = rays.x, *py = rays.y, *pz = rays.z;
+    const double *u = rays.u, *v = rays.v, *w = rays.w;
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        double offset = (px[j] - x) * nx + (py[j] - y) * ny + (pz[j] - z) * nz;
+        double dist = plane_distance(offset, u[j] * nx + v[j] * ny + w[j] * nz);
+
+        double current = nearest[j];
+        nearest[j] = (dist >= 0.0 && dist < current) ? dist : current;
+    }
+}
+
+void nearest_axis_quadric_distance(const axis_quadric_set &quadrics, std::size_t i,
+                                   const ray_packet &rays, double *nearest) {
+    double x = quadrics.x[i], y = quadrics.y[i], z = quadrics.z[i];
+    double sx = quadrics.sx[i], sy = quadrics.sy[i], sz = quadrics.sz[i];
+    double r = quadrics.r[i];
+
+    const double *px = rays.x, *py = rays.y, *pz = rays.z;
+    const double *u = rays.u, *v = rays.v, *w = rays.w;
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        double dist =
+            axis_quadric_distance(px[j] - x, py[j] - y, pz[j] - z, u[j], v[j], w[j], sx, sy, sz, r);
+
+        double current = nearest[j];
+        nearest[j] = (dist >= 0.0 && dist < current) ? dist : current;
+    }
+}
+
+void nearest_box_distance(const box_set &boxes, std::size_t i, const ray_packet &rays,
+                          double *nearest) {
+    double min_x = boxes.min_x[i], min_y = boxes.min_y[i], min_z = boxes.min_z[i];
+    double max_x = boxes.max_x[i], max_y = boxes.max_y[i], max_z = boxes.max_z[i];
+
+    const double *px = rays.x, *py = rays.y, *pz = rays.z;
+    const double *inv_u = rays.inv_u, *inv_v = rays.inv_v, *inv_w = rays.inv_w;
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        double entry = -inf, exit = inf;
+        slab_axis(px[j], inv_u[j], min_x, max_x, entry, exit);
+        slab_axis(py[j], inv_v[j], min_y, max_y, entry, exit);
+        slab_axis(pz[j], inv_w[j], min_z, max_z, entry, exit);
+
+        double dist = box_distance(entry, exit);
+
+        double current = nearest[j];
+        nearest[j] = dist < current ? dist : current;
+    }
+}
+
+void nearest_quadric_distance(const quadric_set &quadrics, std::size_t i, const ray_packet &rays,
+                              double *nearest) {
+    double x = quadrics.x[i], y = quadrics.y[i], z = quadrics.z[i];
+    auto k = quadric_coefficients(quadrics, i);
+
+    const double *px = rays.x, *py = rays.y, *pz = rays.z;
+    const double *u = rays.u, *v = rays.v, *w = rays.w;
+
+    #pragma omp simd
+    for (std::size_t j = 0; j < rays.size; ++j) {
+        double dist = quadric_distance(px[j] - x, py[j] - y, pz[j] - z, u[j], v[j], w[j], k);
+
+        double current = nearest[j];
+        nearest[j] = (dist >= 0.0 && dist < current) ? dist : current;
+    }
+}
+
+} // namespace projector
@@ -0,0 +1,40 @@
+#include "tally_filter.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+int find_edge_bin(const std::vector<double> &edges, double value) {
+
+    auto found = std::upper_bound(edges.begin(), edges.end(), value);
+
+    if (found == edges.begin() || found == edges.end()) {
+        return -1;
+    }
+
+    return static_cast<int>(std::distance(edges.begin(), found)) - 1;
+}
+
+} // namespace
+
+namespace projector {
+
+int tally_filter::find_bin(const particle_step &step) const {
+
+    switch (type) {
+    case filter_type::energy:
+        return find_edge_bin(edges, step.energy);
+    case filter_type::generation:
+        return find_edge_bin(edges, static_cast<double>(step.generation));
+    case filter_type::interaction:
+        return bins[static_cast<std::size_t>(step.interaction)];
+    case filter_type::object:
+    case filter_type::material:
+        return step.object < bins.size() ? bins[step.object] : -1;
+    }
+
+    return -1;
+}
+
+} // namespace projector
@@ -0,0 +1,63 @@
+#include "tally.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace projector {
+
+tally_scorer::tally_scorer(const std::vector<std::unique_ptr<tally>> &tallies,
+                           const std::vector<std::unique_ptr<tally_filter>> &filt) {
+
+    for (const auto &f : filt) {
+        filters.push_back(f.get());
+    }
+
+    for (const auto &t : tallies) {
+        const uniform_mesh *mesh = t->mesh();
+
+        if (mesh == nullptr) {
+            other_tallies.push_back(t.get());
+            continue;
+        }
+
+        auto group = std::find_if(groups.begin(), groups.end(),
+                                  [mesh](const mesh_group &g) { return *g.mesh == *mesh; });
+
+        if (group == groups.end()) {
+            groups.push_back({mesh, false, false, {}});
+            group = std::prev(groups.end());
+        }
+
+        group->tracks = group->tracks || t->scores_tracks();
+        group->interactions = group->interactions || !t->scores_tracks();
+        group->tallies.push_back(t.get());
+    }
+}
+
+void tally_scorer::score_step(const particle_step &step) const {
+
+    // crossed cells of the current step, reused by the thread for all steps
+    thread_local std::vector<track_cell> track;
+    thread_local std::vector<int> filter_bins;
+
+    // the bins of each filter are found once, for all tallies using the filter
+    filter_bins.resize(filters.size());
+    for (std::size_t i = 0; i < filters.size(); ++i) {
+        filter_bins[i] = filters[i]->find_bin(step);
+    }
+
+    for (const auto &group : groups) {
+        mesh_step lookup = group.mesh->lookup(step, group.tracks, group.interactions, track);
+        lookup.filter_bins = filter_bins;
+
+        for (tally *t : group.tallies) {
+            t->score_mesh_step(lookup);
+        }
+    }
+
+    for (tally *t : other_tallies) {
+        t->score_step(step);
+    }
+}
+
+} // namespace projector
@@ -0,0 +1,49 @@
+#include "uniform_mesh.hpp"
+
+namespace projector {
+
+std::optional<coord3> uniform_mesh::determine_cell(const vec3 &point) const {
+    if (!bounds.point_inside(point)) {
+        return {};
+    }
+
+    coord3 output = {0, 0, 0};
+
+    for (std::size_t i = 0; i < 3; ++i) {
+        double shifted = point[i] - bounds.min[i];
+        double step_size = std::abs(bounds.max[i] - bounds.min[i]) / resolution[i];
+        double out = std::floor(shifted / step_size);
+
+        output[i] = out;
+    }
+
+    return output;
+}
+
+std::size_t uniform_mesh::calculate_index(const coord3 &c) const {
+    std::size_t i = c.z() * (resolution.x() * resolution.y()) + c.y() * resolution.x() + c.x();
+
+    return i;
+}
+
+mesh_step uniform_mesh::lookup(const particle_step &step, bool tracks, bool interactions,
+                               std::vector<track_cell> &track) const {
+    track.clear();
+
+    if (tracks) {
+        traverse(step.start, step.end,
+                 [&track](std::size_t cell, double length) { track.push_back({cell, length}); });
+    }
+
+    std::optional<std::size_t> interaction_cell;
+
+    if (interactions) {
+        if (auto coord = determine_cell(step.end)) {
+            interaction_cell = calculate_index(*coord);
+        }
+    }
+
+    return {step, track, interaction_cell, {}};
+}
+
+} // namespace projector
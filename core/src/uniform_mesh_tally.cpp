@@ -1,183 +1,227 @@
 #include "constants.hpp"
 #include "tally.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <type_traits>
 
+#include <omp.h>
+
 namespace {
 
-double distance_to_aligned_plane(double x, double x_0, double u) {
+/// Scale of the fixed point energy scores of the deterministic accumulation. The resolution is
+/// 2^-32 (about 2e-10 MeV or cm), a single thread can accumulate up to 2^31 in a cell per batch.
+constexpr double fixed_point_scale = 4294967296.0;
 
-    if (u == 0.0) {
-        return projector::constants::infinity;
-    }
-    double distance = (x_0 - x) / u;
+/// Largest score of the deterministic accumulation, larger scores do not fit the fixed point
+constexpr double fixed_point_limit = 2147483648.0;
 
-    if (distance < 0.0 || distance > 1.0) {
-        return projector::constants::infinity;
-    }
-    return distance;
-}
+/// Private buffers up to this size are allocated densely, larger ones by pages on first use
+constexpr std::size_t dense_buffer_limit = std::size_t(16) << 20;
 
 } // namespace
 
 namespace projector {
 
-std::optional<coord3> uniform_mesh_tally::determine_cell(const vec3 &point) const {
-    if (!bounds.point_inside(point)) {
-        return {};
+void tally::add_particle(const particle &p) {
+    // start at index 1, as index 0 is always initial particle state and that does not do anything
+    for (std::size_t i = 1; i < p.history.points.size(); ++i) {
+        score_step(p.step(i));
     }
+}
 
-    coord3 output = {0, 0, 0};
+template <typename Real>
+double basic_uniform_mesh_tally<Real>::data_at(std::size_t index) const {
+    return counts.empty() ? values[index] : static_cast<double>(counts[index]);
+}
 
-    for (std::size_t i = 0; i < 3; ++i) {
-        double shifted = point[i] - bounds.min[i];
-        double step_size = std::abs(bounds.max[i] - bounds.min[i]) / resolution[i];
-        double out = std::floor(shifted / step_size);
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::increment_count(std::size_t index) {
 
-        output[i] = out;
+    if (accumulation != tally_accumulation::atomic) {
+        buffers[omp_get_thread_num()].integers.add(index, 1);
+        return;
     }
 
-    return output;
-}
+    uint64_t &count = counts[index];
 
-std::size_t uniform_mesh_tally::calculate_index(const coord3 &c) const {
-    std::size_t i = c.z() * (resolution.x() * resolution.y() * stride) +
-                    c.y() * resolution.x() * stride + c.x() * stride;
-
-    return i;
+#pragma omp atomic
+    count += 1;
 }
 
-std::vector<double> uniform_mesh_tally::calculate_intersections(const vec3 &start,
-                                                                const vec3 &end) const {
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::add_value(std::size_t index, double value) {
 
-    vec3 dir = end - start;
-    std::vector<double> out;
+    switch (accumulation) {
+    case tally_accumulation::atomic: {
+        // double scores are added to the data directly, only reduced precision ones are
+        // accumulated separately
+        if constexpr (std::is_same_v<Real, double>) {
+            double &arg = values[index];
 
-    for (std::size_t index = 0; index < 3; ++index) {
-        double step = (bounds.max[index] - bounds.min[index]) / resolution[index];
+#pragma omp atomic
+            arg += value;
+        } else {
+            Real &arg = accumulated[index];
 
-        for (int i = 0; i < resolution[index]; ++i) {
-            double temp_dist =
-                distance_to_aligned_plane(start[index], bounds.min[index] + i * step, dir[index]);
-            if (temp_dist == projector::constants::infinity) {
-                continue;
-            }
-            out.push_back(temp_dist);
+#pragma omp atomic
+            arg += static_cast<Real>(value);
         }
+        break;
     }
-    return out;
-}
-
-void uniform_mesh_tally::increment_index(std::size_t index) {
-
-    auto increment_visit = [](auto &&arg) {
-        using T = std::decay_t<decltype(arg)>;
+    case tally_accumulation::thread_private:
+        buffers[omp_get_thread_num()].values.add(index, static_cast<Real>(value));
+        break;
+    case tally_accumulation::deterministic: {
+        thread_buffer &buffer = buffers[omp_get_thread_num()];
 
-        if constexpr (std::is_arithmetic_v<T>) {
-#pragma omp atomic
-            arg += 1;
+        // the error can not be thrown from the transport threads, it is reported at the reduction
+        if (!(std::abs(value) < fixed_point_limit) ||
+            !buffer.integers.add_checked(index, std::llround(value * fixed_point_scale))) {
+            buffer.overflow = true;
         }
-    };
-
-    { std::visit(increment_visit, data[index]); }
+        break;
+    }
+    }
 }
 
-void uniform_mesh_tally::add_index(std::size_t index, double value) {
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::reduce_buffers() {
 
-    auto add_visit = [&value](auto &&arg) {
-        using T = std::decay_t<decltype(arg)>;
+    std::size_t page_size = paged_buffer<Real>::page_size;
+    std::size_t page_count = (data_size() + page_size - 1) / page_size;
 
-        if constexpr (std::is_arithmetic_v<T>) {
-#pragma omp atomic
-            arg += value;
-        }
-    };
+    bool fixed_point = accumulation == tally_accumulation::deterministic;
 
-    { std::visit(add_visit, data[index]); }
-}
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t p = 0; p < page_count; ++p) {
+        std::size_t first = p * page_size;
+        std::size_t size = std::min(page_size, data_size() - first);
 
-void uniform_mesh_tally::add_particle_interactionwise(const particle &p) {
-    std::size_t amount = p.history.points.size();
+        for (auto &buffer : buffers) {
+            if (!counts.empty()) {
+                int64_t *page = buffer.integers.page(p);
+                if (page == nullptr) {
+                    continue;
+                }
+                for (std::size_t i = 0; i < size; ++i) {
+                    counts[first + i] += static_cast<uint64_t>(page[i]);
+                }
+                std::fill(page, page + size, 0);
+            } else if (fixed_point) {
+                int64_t *page = buffer.integers.page(p);
+                if (page == nullptr) {
+                    continue;
+                }
+                for (std::size_t i = 0; i < size; ++i) {
+                    values[first + i] += page[i] / fixed_point_scale;
+                }
+                std::fill(page, page + size, 0);
+            } else {
+                Real *page = buffer.values.page(p);
+                if (page == nullptr) {
+                    continue;
+                }
+                for (std::size_t i = 0; i < size; ++i) {
+                    values[first + i] += static_cast<double>(page[i]);
+                }
+                std::fill(page, page + size, Real(0));
+            }
+        }
+    }
 
-    // start at index 1, as index 0 is always initial particle state and that does not do anything
-    for (std::size_t i = 1; i < amount; ++i) {
+    for (auto &buffer : buffers) {
+        if (buffer.overflow) {
+            throw std::runtime_error("fixed point overflow in the deterministic accumulation of "
+                                     "tally " + id + ", use a smaller batch size");
+        }
+    }
+}
 
-        auto coord = determine_cell(p.history.points[i]);
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::reduce_accumulated() {
 
-        if (!coord) {
-            continue;
-        }
+    if (!buffers.empty()) {
+        reduce_buffers();
+    }
 
-        std::size_t data_index = calculate_index(*coord);
+    for (std::size_t i = 0; i < accumulated.size(); ++i) {
+        values[i] += static_cast<double>(accumulated[i]);
+        accumulated[i] = Real(0);
+    }
+}
 
-        if (score == tally_score::interaction_counts) {
-            if (p.history.interactions[i] != cross_section::no_interaction) {
+template <typename Real>
+std::optional<std::size_t>
+basic_uniform_mesh_tally<Real>::filter_offset(const mesh_step &step) const {
 
-                increment_index(data_index);
+    std::size_t bin = 0;
 
-                data_index += static_cast<std::size_t>(p.history.interactions[i]);
+    for (const tally_filter *filter : filters) {
+        int filter_bin = step.filter_bins[filter->slot];
 
-                increment_index(data_index);
-            }
+        if (filter_bin < 0) {
+            return {};
         }
 
-        else if (score == tally_score::deposited_energy) {
-            double energy_diff = p.history.energies[i - 1] - p.history.energies[i];
-            add_index(data_index, energy_diff);
-        }
+        bin = bin * filter->bin_count + static_cast<std::size_t>(filter_bin);
     }
-}
 
-void uniform_mesh_tally::add_particle_segmentwise(const particle &p) {
+    return bin * stride * cell_count;
+}
 
-    std::size_t amount = p.history.points.size() - 1;
+template <typename Real>
+template <tally_score S>
+void basic_uniform_mesh_tally<Real>::score_interaction(const mesh_step &step,
+                                                       std::size_t offset) {
 
-    // change to DDA algorithm!
-    for (std::size_t i = 0; i < amount; ++i) {
+    if (!step.interaction_cell) {
+        return;
+    }
 
-        const vec3 &start = p.history.points[i];
-        const vec3 &end = p.history.points[i + 1];
+    std::size_t cell = offset + *step.interaction_cell;
 
-        if (!bounds.segment_intersect(start, end)) {
-            continue;
+    if constexpr (S == tally_score::interaction_counts) {
+        if (step.step.interaction != cross_section::no_interaction) {
+            // the total count, followed by the counts of each interaction
+            increment_count(cell);
+            increment_count(static_cast<std::size_t>(step.step.interaction) * cell_count + cell);
         }
+    } else if constexpr (S == tally_score::deposited_energy) {
+        add_value(cell, step.step.energy - step.step.end_energy);
+    }
+}
 
-        std::vector<double> intersects = calculate_intersections(start, end);
-
-        for (double &t : intersects) {
-            // get a point a tiny bit behind the intersection
-            vec3 point = start + (t + 50 * constants::epsilon) * (end - start);
-
-            auto coordinates = determine_cell(point);
+template <typename Real>
+template <tally_score S>
+void basic_uniform_mesh_tally<Real>::score_segment(const mesh_step &step, std::size_t offset) {
 
-            if (!coordinates) {
-                continue;
-            }
+    for (auto [index, length] : step.track) {
+        std::size_t cell = offset + index;
 
-            std::size_t data_index = calculate_index(*coordinates);
-
-            switch (score) {
-            case tally_score::flux:
-                increment_index(data_index);
-                break;
-            case tally_score::average_energy:
-                add_index(data_index, p.history.energies[i]);
-                increment_index(data_index + 1);
-                break;
-            default:
-                break;
-            }
+        if constexpr (S == tally_score::flux) {
+            add_value(cell, length);
+        } else if constexpr (S == tally_score::average_energy) {
+            // the energy weighted by the track length, followed by the track length
+            add_value(cell, length * step.step.energy);
+            add_value(cell_count + cell, length);
         }
     }
 }
 
-uniform_mesh_tally::uniform_mesh_tally(std::string user_id, const vec3 &start, const vec3 &end,
-                                       const coord3 &res, tally_score sc)
-    : id(user_id), resolution(res), score(sc) {
+template <typename Real>
+basic_uniform_mesh_tally<Real>::basic_uniform_mesh_tally(std::string user_id, const vec3 &start,
+                                                         const vec3 &end, const coord3 &res,
+                                                         tally_score sc, tally_accumulation acc,
+                                                         std::vector<const tally_filter *> filt)
+    : id(user_id), filters(std::move(filt)), accumulation(acc), score(sc) {
+
+    grid.bounds.min = start;
+    grid.bounds.max = end;
+    grid.resolution = res;
 
-    bounds.min = start;
-    bounds.max = end;
+    cell_count = grid.cell_count();
 
     switch (score) {
     case tally_score::flux:
@@ -194,55 +238,218 @@ uniform_mesh_tally::uniform_mesh_tally(std::string user_id, const vec3 &start, c
         throw std::runtime_error("unsupported score for uniform mesh tally");
         break;
     }
+
+    for (const tally_filter *filter : filters) {
+        filter_bin_count *= filter->bin_count;
+    }
 }
 
-void uniform_mesh_tally::init_tally() {
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::init_tally() {
 
-    std::size_t total = resolution.x() * resolution.y() * resolution.z() * stride;
+    std::size_t total = data_size();
+
+    bool integer = score == tally_score::interaction_counts;
+
+    if (integer) {
+        counts.resize(total, 0);
+    } else {
+        values.resize(total, 0.0);
+    }
+
+    if (accumulation == tally_accumulation::atomic) {
+        if (!integer && !std::is_same_v<Real, double>) {
+            accumulated.resize(total, Real(0));
+        }
+        return;
+    }
+
+    // private buffers for all threads, only the buffer used by the accumulation is allocated
+    buffers = std::vector<thread_buffer>(omp_get_max_threads());
+
+    integer = integer || accumulation == tally_accumulation::deterministic;
+    bool dense = total * (integer ? sizeof(int64_t) : sizeof(Real)) <= dense_buffer_limit;
+
+    for (auto &buffer : buffers) {
+        if (integer) {
+            buffer.integers.resize(total, dense);
+        } else {
+            buffer.values.resize(total, dense);
+        }
+    }
+}
+
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::score_step(const particle_step &step) {
+
+    thread_local std::vector<track_cell> track;
+    thread_local std::vector<int> filter_bins;
+
+    for (const tally_filter *filter : filters) {
+        if (filter_bins.size() <= filter->slot) {
+            filter_bins.resize(filter->slot + 1);
+        }
+        filter_bins[filter->slot] = filter->find_bin(step);
+    }
+
+    mesh_step lookup = grid.lookup(step, scores_tracks(), !scores_tracks(), track);
+    lookup.filter_bins = filter_bins;
+
+    score_mesh_step(lookup);
+}
+
+template <typename Real>
+const uniform_mesh *basic_uniform_mesh_tally<Real>::mesh() const {
+    return &grid;
+}
+
+template <typename Real>
+bool basic_uniform_mesh_tally<Real>::scores_tracks() const {
+    return score == tally_score::flux || score == tally_score::average_energy;
+}
+
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::score_mesh_step(const mesh_step &step) {
+
+    std::optional<std::size_t> offset = filter_offset(step);
+
+    if (!offset) {
+        return;
+    }
 
-    // init to proper type depending on score
     switch (score) {
+    case tally_score::flux:
+        score_segment<tally_score::flux>(step, *offset);
+        break;
     case tally_score::average_energy:
-    case tally_score::deposited_energy:
-        data.resize(total, double(0.0));
+        score_segment<tally_score::average_energy>(step, *offset);
         break;
-    case tally_score::flux:
     case tally_score::interaction_counts:
-        data.resize(total, int(0));
+        score_interaction<tally_score::interaction_counts>(step, *offset);
+        break;
+    case tally_score::deposited_energy:
+        score_interaction<tally_score::deposited_energy>(step, *offset);
         break;
     default:
         break;
     }
 }
 
-void uniform_mesh_tally::add_particle(const particle &p) {
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::flush_scores() {
 
-    switch (score) {
-    case tally_score::interaction_counts:
-    case tally_score::deposited_energy:
-        add_particle_interactionwise(p);
-        break;
-    case tally_score::flux:
-    case tally_score::average_energy:
-        add_particle_segmentwise(p);
-        break;
-    default:
-        break;
+    // the double scores are reduced only at the end of the batch
+    if constexpr (!std::is_same_v<Real, double>) {
+        reduce_accumulated();
+    }
+}
+
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::end_batch(std::size_t particle_count) {
+
+    if (batches == 0) {
+        previous_total.resize(data_size(), 0.0);
+        batch_sum.resize(data_size(), 0.0);
+        batch_sum_sq.resize(data_size(), 0.0);
     }
+
+    reduce_accumulated();
+
+    for (std::size_t i = 0; i < data_size(); ++i) {
+        double total = data_at(i);
+        double value = (total - previous_total[i]) / particle_count;
+
+        previous_total[i] = total;
+        batch_sum[i] += value;
+        batch_sum_sq[i] += value * value;
+    }
+
+    batches++;
+}
+
+template <typename Real>
+double basic_uniform_mesh_tally<Real>::relative_error_at(std::size_t index) const {
+
+    if (batches < 2 || batch_sum[index] == 0.0) {
+        return constants::infinity;
+    }
+
+    double n = static_cast<double>(batches);
+    double mean = batch_sum[index] / n;
+    double variance = std::max(0.0, batch_sum_sq[index] / n - mean * mean) / (n - 1.0);
+
+    return std::sqrt(variance) / std::abs(mean);
 }
 
-void uniform_mesh_tally::finalize_data() {
-    // calculate the average
+template <typename Real>
+double basic_uniform_mesh_tally<Real>::relative_error(double score_fraction) const {
+
+    if (batches < 2) {
+        return constants::infinity;
+    }
+
+    // the largest relative error of the scored values, each data column is checked separately as
+    // the columns hold different quantities
+    double max_error = 0.0;
+    bool scored = false;
+
+    for (std::size_t k = 0; k < stride; ++k) {
+
+        double max_score = 0.0;
+        for (std::size_t f = 0; f < filter_bin_count; ++f) {
+            std::size_t first = (f * stride + k) * cell_count;
+            for (std::size_t c = 0; c < cell_count; ++c) {
+                max_score = std::max(max_score, std::abs(batch_sum[first + c]));
+            }
+        }
+
+        double min_score = score_fraction * max_score;
+
+        for (std::size_t f = 0; f < filter_bin_count; ++f) {
+            std::size_t first = (f * stride + k) * cell_count;
+            for (std::size_t c = 0; c < cell_count; ++c) {
+                double score = std::abs(batch_sum[first + c]);
+
+                if (score == 0.0 || score < min_score) {
+                    continue;
+                }
+                max_error = std::max(max_error, relative_error_at(first + c));
+                scored = true;
+            }
+        }
+    }
+
+    return scored ? max_error : constants::infinity;
+}
+
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::finalize_data() {
+
+    reduce_accumulated();
+
+    // track length estimator of the flux, the track length per cell volume
+    if (score == tally_score::flux) {
+        double volume = grid.cell_volume();
+
+        for (double &value : values) {
+            value /= volume;
+        }
+    }
+
+    // calculate the track length weighted average, in each filter bin
     if (score == tally_score::average_energy) {
-        for (std::size_t i = 0; i < data.size(); i += 2) {
-            double sum = std::get<double>(data[i]);
-            double count = std::get<double>(data[i + 1]);
-            data[i] = sum / count;
+        for (std::size_t f = 0; f < filter_bin_count; ++f) {
+            double *energy = values.data() + f * stride * cell_count;
+
+            for (std::size_t c = 0; c < cell_count; ++c) {
+                energy[c] /= energy[cell_count + c];
+            }
         }
     }
 }
 
-void uniform_mesh_tally::save_tally(const std::filesystem::path path) const {
+template <typename Real>
+void basic_uniform_mesh_tally<Real>::save_tally(const std::filesystem::path path) const {
 
     std::string filename = id + ".csv";
 
@@ -252,32 +459,73 @@ void uniform_mesh_tally::save_tally(const std::filesystem::path path) const {
         throw std::runtime_error("failed to open file: " + path.string());
     }
 
+    // relative errors are only available with batch statistics
+    bool save_errors = batches > 1;
+
     output_file << "x,y,z";
+    for (const tally_filter *filter : filters) {
+        output_file << "," << filter->id;
+    }
     for (std::size_t i = 0; i < stride; ++i) {
         output_file << ",data" << i;
     }
+    if (save_errors) {
+        for (std::size_t i = 0; i < stride; ++i) {
+            output_file << ",rel_err" << i;
+        }
+    }
     output_file << "\n";
 
     output_file << std::setprecision(10) << std::scientific;
 
-    auto print_variant = [&output_file]<typename T>(T &&arg) { output_file << "," << arg; };
+    // bins of each filter in the current combination
+    std::vector<std::size_t> bins(filters.size(), 0);
 
-    for (int z = 0; z < resolution.z(); ++z) {
-        for (int y = 0; y < resolution.y(); ++y) {
-            for (int x = 0; x < resolution.x(); ++x) {
+    for (std::size_t f = 0; f < filter_bin_count; ++f) {
 
-                output_file << x << "," << y << "," << z;
+        // split the combination into the bins, the last filter varies fastest
+        std::size_t combination = f;
+        for (std::size_t i = filters.size(); i-- > 0;) {
+            bins[i] = combination % filters[i]->bin_count;
+            combination /= filters[i]->bin_count;
+        }
 
-                std::size_t base = calculate_index({x, y, z});
+        std::size_t offset = f * stride * cell_count;
 
-                for (std::size_t i = 0; i < stride; ++i) {
-                    std::visit(print_variant, data[base + i]);
-                }
+        for (int z = 0; z < grid.resolution.z(); ++z) {
+            for (int y = 0; y < grid.resolution.y(); ++y) {
+                for (int x = 0; x < grid.resolution.x(); ++x) {
+
+                    output_file << x << "," << y << "," << z;
+
+                    for (std::size_t bin : bins) {
+                        output_file << "," << bin;
+                    }
+
+                    std::size_t cell = offset + grid.calculate_index({x, y, z});
 
-                output_file << "\n";
+                    for (std::size_t i = 0; i < stride; ++i) {
+                        if (counts.empty()) {
+                            output_file << "," << values[i * cell_count + cell];
+                        } else {
+                            output_file << "," << counts[i * cell_count + cell];
+                        }
+                    }
+
+                    if (save_errors) {
+                        for (std::size_t i = 0; i < stride; ++i) {
+                            output_file << "," << relative_error_at(i * cell_count + cell);
+                        }
+                    }
+
+                    output_file << "\n";
+                }
             }
         }
     }
 }
 
-} // namespace projector
\ No newline at end of file
+template class basic_uniform_mesh_tally<float>;
+template class basic_uniform_mesh_tally<double>;
+
+} // namespace projector
@@ -0,0 +1,275 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include "material.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+// These tests need the eprdata14 library, they are skipped when PROJECTOR_ACE_XSDIR is not set
+
+namespace {
+
+/// Material with all the elements of the library
+std::vector<projector::material_data> all_elements() {
+    projector::material_data all;
+    for (std::size_t i = 1; i <= 100; ++i) {
+        all.elements.push_back(i);
+    }
+    return {all};
+}
+
+} // namespace
+
+TEST_CASE("Binary cache matches the ACE data") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::filesystem::path cache_path =
+        std::filesystem::temp_directory_path() / "projector_tests_cache.bin";
+    std::filesystem::remove(cache_path);
+
+    // the missing cache is built on load
+    projector::data_library binary = projector::data_library::load_binary_data(xsdir, cache_path);
+    REQUIRE(std::filesystem::exists(cache_path));
+
+    projector::data_library text = projector::data_library::load_ace_data(xsdir);
+    text.load_elements(all_elements());
+
+    for (std::size_t z = 1; z <= 100; ++z) {
+        const projector::element &expected = text.get_element(z);
+        const projector::element &cached = binary.get_element(z);
+
+        REQUIRE(cached.atomic_weight == expected.atomic_weight);
+
+        std::span<const double> grid = expected.energy_grid();
+        REQUIRE(std::equal(grid.begin(), grid.end(), cached.energy_grid().begin(),
+                           cached.energy_grid().end()));
+
+        for (double energy : grid) {
+            REQUIRE(cached.get_all_cross_sections(energy).total ==
+                    expected.get_all_cross_sections(energy).total);
+        }
+
+        for (double x : {0.0, 1e-3, 0.1, 1.0, 10.0}) {
+            using projector::form_factor;
+            for (form_factor ff : {form_factor::incoherent, form_factor::cumulative_coherent,
+                                   form_factor::differential_coherent}) {
+                REQUIRE(cached.get_form_factor(x, ff) == expected.get_form_factor(x, ff));
+            }
+        }
+    }
+
+    std::filesystem::remove(cache_path);
+}
+
+TEST_CASE("Empty and truncated binary caches are rebuilt") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::filesystem::path cache_path =
+        std::filesystem::temp_directory_path() / "projector_tests_rebuild.bin";
+    std::filesystem::remove(cache_path);
+
+    projector::data_library::load_binary_data(xsdir, cache_path);
+    std::uintmax_t full_size = std::filesystem::file_size(cache_path);
+
+    // an empty file, only a part of the header, and the header without the tables
+    for (std::uintmax_t size : {std::uintmax_t{0}, std::uintmax_t{16}, full_size / 2}) {
+        std::filesystem::resize_file(cache_path, size);
+
+        projector::data_library binary =
+            projector::data_library::load_binary_data(xsdir, cache_path);
+
+        REQUIRE(std::filesystem::file_size(cache_path) == full_size);
+        REQUIRE_FALSE(binary.get_element(82).energy_grid().empty());
+    }
+
+    std::filesystem::remove(cache_path);
+}
+
+TEST_CASE("Only the elements of the materials are loaded") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    projector::data_library full = projector::data_library::load_ace_data(xsdir);
+    full.load_elements(all_elements());
+
+    projector::data_library library = projector::data_library::load_ace_data(xsdir);
+
+    projector::material_data water;
+    water.elements = {1, 8};
+    projector::material_data lead;
+    lead.elements = {82};
+
+    // the elements are added by later loads, the loaded ones are kept
+    library.load_elements({water, lead});
+    library.load_elements({lead});
+
+    projector::material_data iron;
+    iron.elements = {26, 8};
+    library.load_elements({iron});
+
+    for (std::size_t z = 1; z <= 100; ++z) {
+        const projector::element &elem = library.get_element(z);
+        bool used = z == 1 || z == 8 || z == 26 || z == 82;
+
+        REQUIRE(elem.loaded() == used);
+        if (!used) {
+            continue;
+        }
+
+        const projector::element &reference = full.get_element(z);
+        REQUIRE(elem.atomic_number == reference.atomic_number);
+        REQUIRE(elem.atomic_weight == reference.atomic_weight);
+
+        for (std::size_t i = 0; i < 5; ++i) {
+            std::span<const double> xs = elem.cross_section_table(i);
+            std::span<const double> ff = elem.form_factor_table(i);
+
+            REQUIRE(std::ranges::equal(xs, reference.cross_section_table(i)));
+            REQUIRE(std::ranges::equal(ff, reference.form_factor_table(i)));
+        }
+    }
+}
+
+namespace {
+
+/// Element tables of the library, read with stream extraction as the reference
+struct reference_tables {
+    std::array<std::vector<double>, 5> xs;
+    std::array<std::vector<double>, 5> ff;
+};
+
+/// Read the reference tables of all elements, the tables of each element are located by the
+/// xsdir file. Returns also the size of the parsed text.
+std::vector<reference_tables> read_reference(const std::filesystem::path &xsdir,
+                                             std::size_t &bytes) {
+    std::ifstream xsdir_stream(xsdir);
+    std::vector<reference_tables> library;
+    bytes = 0;
+
+    std::string line;
+    while (library.size() < 100 && std::getline(xsdir_stream, line)) {
+        std::istringstream fields(line);
+        std::string name, weight, file, access, type;
+        std::size_t start_line;
+        fields >> name >> weight >> file >> access >> type >> start_line;
+
+        std::ifstream ace(xsdir.parent_path() / file);
+        for (std::size_t i = 0; i < start_line - 1 + 6; ++i) {
+            ace.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        std::streamoff start = ace.tellg();
+
+        std::array<std::size_t, 16> nxs;
+        std::array<std::size_t, 32> jxs;
+        for (auto &value : nxs) {
+            ace >> value;
+        }
+        for (auto &value : jxs) {
+            ace >> value;
+        }
+
+        std::size_t n_y = nxs[2];
+        std::size_t n_inc = (jxs[2] - jxs[1]) / 2;
+        std::size_t n_coh = (jxs[3] - jxs[2]) / 3;
+
+        reference_tables tables;
+        auto read = [&ace](std::vector<double> &table, std::size_t count, bool unlog) {
+            for (std::size_t i = 0; i < count; ++i) {
+                double value;
+                ace >> value;
+                table.push_back(unlog && value != 0.0 ? std::exp(value) : value);
+            }
+        };
+        for (auto &table : tables.xs) {
+            read(table, n_y, true);
+        }
+        for (std::size_t i = 0; i < 5; ++i) {
+            read(tables.ff[i], i < 2 ? n_inc : n_coh, false);
+        }
+
+        bytes += ace.tellg() - start;
+        library.push_back(std::move(tables));
+    }
+
+    return library;
+}
+
+} // namespace
+
+TEST_CASE("ACE parser matches stream extraction over the whole library") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::size_t bytes;
+    std::vector<reference_tables> reference = read_reference(xsdir, bytes);
+    REQUIRE(reference.size() == 100);
+
+    projector::data_library library = projector::data_library::load_ace_data(xsdir);
+    library.load_elements(all_elements());
+
+    for (std::size_t z = 1; z <= 100; ++z) {
+        const projector::element &elem = library.get_element(z);
+
+        for (std::size_t i = 0; i < 5; ++i) {
+            std::span<const double> xs = elem.cross_section_table(i);
+            std::span<const double> ff = elem.form_factor_table(i);
+
+            REQUIRE(std::equal(xs.begin(), xs.end(), reference[z - 1].xs[i].begin(),
+                               reference[z - 1].xs[i].end()));
+            REQUIRE(std::equal(ff.begin(), ff.end(), reference[z - 1].ff[i].begin(),
+                               reference[z - 1].ff[i].end()));
+        }
+    }
+}
+
+TEST_CASE("ACE parsing throughput", "[.benchmark]") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    auto start = clock::now();
+    std::size_t bytes;
+    read_reference(xsdir, bytes);
+    double stream_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    start = clock::now();
+    projector::data_library library = projector::data_library::load_ace_data(xsdir);
+    library.load_elements(all_elements());
+    double parser_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    double megabytes = static_cast<double>(bytes) / 1e6;
+
+    std::cout << "ACE data: " << megabytes << " MB" << std::endl;
+    std::cout << "stream extraction: " << megabytes / stream_seconds << " MB/s" << std::endl;
+    std::cout << "bulk parser: " << megabytes / parser_seconds << " MB/s" << std::endl;
+
+    BENCHMARK("bulk parser") {
+        projector::data_library data = projector::data_library::load_ace_data(xsdir);
+        data.load_elements(all_elements());
+        return data.get_element(1).atomic_weight;
+    };
+}
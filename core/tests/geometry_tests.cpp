@@ -1,3 +1,213 @@
 #include <catch2/catch_test_macros.hpp>
+#include "bvh.hpp"
 #include "geometry.hpp"
+#include "random_numbers.hpp"
 
+namespace {
+
+std::vector<projector::bounding_box> random_boxes(std::size_t count, uint64_t &prng_state) {
+    projector::bounding_box world = {{-10.0, -10.0, -10.0}, {10.0, 10.0, 10.0}};
+    std::vector<projector::bounding_box> boxes;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        projector::vec3 a = world.random_sample(prng_state);
+        projector::vec3 b = world.random_sample(prng_state);
+        boxes.push_back({a.cwiseMin(b), a.cwiseMax(b)});
+    }
+
+    return boxes;
+}
+
+bool contains(const projector::bounding_box &box, const projector::vec3 &point) {
+    return (point.array() >= box.min.array()).all() && (point.array() <= box.max.array()).all();
+}
+
+// (sphere - cylinder) | (slab above the sphere) | box
+// with a nested intersection and a no-op surface
+projector::geometry csg_geometry() {
+    using projector::csg_operation;
+    using projector::vec3;
+
+    projector::geometry body;
+    body.add_surface(std::make_unique<projector::ellipsoid>(vec3{0.0, 0.0, 0.0}, 4.0, 3.0, 5.0),
+                     csg_operation::intersect);
+    body.add_surface(std::make_unique<projector::z_cylinder>(vec3{1.0, 0.0, 0.0}, 1.0, 2.0),
+                     csg_operation::substract);
+    body.add_surface(std::make_unique<projector::plane>(vec3{0.0, 0.0, 0.0}, vec3{1.0, 0.0, 0.0}),
+                     csg_operation::no_op);
+
+    projector::geometry slab;
+    slab.add_surface(std::make_unique<projector::plane>(vec3{0.0, 0.0, 5.0}, vec3{0.0, 0.0, -1.0}),
+                     csg_operation::intersect);
+    slab.add_surface(std::make_unique<projector::plane>(vec3{0.0, 0.0, 7.0}, vec3{0.0, 0.0, 1.0}),
+                     csg_operation::intersect);
+
+    projector::geometry box;
+    box.add_surface(std::move(slab), csg_operation::intersect);
+    box.add_surface(std::make_unique<projector::x_cone>(vec3{-6.0, 0.0, 6.0}, 1.0, 1.0, 1.0),
+                    csg_operation::intersect);
+
+    // cylinder around the (1, 1, 0) axis
+    box.add_surface(std::make_unique<projector::quadric>(
+                        vec3{0.0, 0.0, 6.0},
+                        std::array<double, 10>{0.5, 0.5, 1.0, -1.0, 0.0, 0.0, 0.0, 0.0, 0.0, -9.0}),
+                    csg_operation::substract);
+
+    projector::geometry output;
+    output.add_surface(std::move(body), csg_operation::join);
+    output.add_surface(std::move(box), csg_operation::join);
+    output.add_surface(
+        std::make_unique<projector::box>(vec3{-8.0, -8.0, -8.0}, vec3{-5.0, 0.0, 1.0}),
+        csg_operation::join);
+
+    return output;
+}
+
+} // namespace
+
+TEST_CASE("Compiled CSG matches the tree") {
+    auto tree = csg_geometry();
+    auto compiled = csg_geometry();
+    compiled.compile();
+
+    REQUIRE_FALSE(tree.compiled());
+    REQUIRE(compiled.compiled());
+
+    uint64_t prng_state = 3;
+    projector::bounding_box world = {{-10.0, -10.0, -10.0}, {10.0, 10.0, 10.0}};
+
+    for (std::size_t i = 0; i < 10000; ++i) {
+        projector::vec3 point = world.random_sample(prng_state);
+        projector::vec3 dir = projector::random_unit_vector(prng_state);
+
+        REQUIRE(compiled.point_inside(point) == tree.point_inside(point));
+
+        double expected = tree.nearest_surface_distance(point, dir);
+        double distance = compiled.nearest_surface_distance(point, dir);
+
+        // the no-op plane is dropped from the compiled program
+        if (std::abs(distance - expected) > 1e-9 * std::max(1.0, expected)) {
+            REQUIRE(expected < distance);
+            REQUIRE(std::abs(point.x() + expected * dir.x()) < 1e-9);
+        }
+    }
+}
+
+TEST_CASE("Packet CSG queries match single queries") {
+    auto geom = csg_geometry();
+    geom.compile();
+
+    // not a multiple of the packet width, to test the remainder
+    constexpr std::size_t count = 1000;
+
+    uint64_t prng_state = 4;
+    projector::bounding_box world = {{-10.0, -10.0, -10.0}, {10.0, 10.0, 10.0}};
+
+    std::vector<double> x(count), y(count), z(count), u(count), v(count), w(count);
+    std::vector<double> inv_u(count), inv_v(count), inv_w(count);
+    for (std::size_t j = 0; j < count; ++j) {
+        projector::vec3 point = world.random_sample(prng_state);
+        projector::vec3 dir = projector::random_unit_vector(prng_state);
+        x[j] = point.x(), y[j] = point.y(), z[j] = point.z();
+        u[j] = dir.x(), v[j] = dir.y(), w[j] = dir.z();
+        inv_u[j] = 1.0 / u[j], inv_v[j] = 1.0 / v[j], inv_w[j] = 1.0 / w[j];
+    }
+
+    projector::ray_packet rays = {x.data(), y.data(), z.data(), u.data(), v.data(), w.data(),
+                                  count, inv_u.data(), inv_v.data(), inv_w.data()};
+
+    std::vector<uint8_t> inside(count);
+    std::vector<double> distances(count);
+    geom.points_inside(rays, inside.data());
+    geom.nearest_surface_distances(rays, distances.data());
+
+    for (std::size_t j = 0; j < count; ++j) {
+        projector::vec3 point = {x[j], y[j], z[j]};
+        projector::vec3 dir = {u[j], v[j], w[j]};
+
+        REQUIRE(static_cast<bool>(inside[j]) == geom.point_inside(point));
+        REQUIRE(distances[j] == geom.nearest_surface_distance(point, dir));
+    }
+}
+
+TEST_CASE("BVH point queries") {
+    uint64_t prng_state = 1;
+    auto boxes = random_boxes(200, prng_state);
+
+    projector::bvh tree;
+    tree.build(boxes);
+
+    projector::bounding_box world = {{-10.0, -10.0, -10.0}, {10.0, 10.0, 10.0}};
+
+    for (std::size_t i = 0; i < 1000; ++i) {
+        projector::vec3 point = world.random_sample(prng_state);
+
+        // every third box "contains" the point, to check the test callback
+        auto test = [](std::size_t index) { return index % 3 == 0; };
+
+        std::optional<std::size_t> expected;
+        for (std::size_t j = 0; j < boxes.size(); ++j) {
+            if (contains(boxes[j], point) && test(j)) {
+                expected = j;
+            }
+        }
+
+        REQUIRE(tree.find_last(point, test) == expected);
+    }
+}
+
+TEST_CASE("BVH box queries") {
+    uint64_t prng_state = 3;
+    auto boxes = random_boxes(200, prng_state);
+
+    projector::bvh tree;
+    tree.build(boxes);
+
+    projector::bounding_box world = {{-10.0, -10.0, -10.0}, {10.0, 10.0, 10.0}};
+    std::vector<std::size_t> found;
+
+    for (std::size_t i = 0; i < 1000; ++i) {
+        projector::vec3 a = world.random_sample(prng_state);
+        projector::vec3 b = world.random_sample(prng_state);
+        projector::bounding_box query = {a.cwiseMin(b), a.cwiseMax(b)};
+
+        std::vector<std::size_t> expected;
+        for (std::size_t j = 0; j < boxes.size(); ++j) {
+            if ((query.min.array() <= boxes[j].max.array()).all() &&
+                (query.max.array() >= boxes[j].min.array()).all()) {
+                expected.push_back(j);
+            }
+        }
+
+        tree.find_overlapping(query, found);
+        REQUIRE(found == expected);
+    }
+}
+
+TEST_CASE("BVH distance queries") {
+    uint64_t prng_state = 2;
+    auto boxes = random_boxes(200, prng_state);
+
+    projector::bvh tree;
+    tree.build(boxes);
+
+    projector::bounding_box world = {{-20.0, -20.0, -20.0}, {20.0, 20.0, 20.0}};
+
+    for (std::size_t i = 0; i < 1000; ++i) {
+        projector::vec3 point = world.random_sample(prng_state);
+        projector::vec3 dir = projector::random_unit_vector(prng_state);
+
+        // the item distance is the distance to the far side of the box
+        auto distance = [&](std::size_t index) {
+            auto [entry, exit] = boxes[index].slab_intersect(point, dir.cwiseInverse());
+            return (entry <= exit && exit >= 0.0) ? exit : projector::constants::infinity;
+        };
+
+        double expected = projector::constants::infinity;
+        for (std::size_t j = 0; j < boxes.size(); ++j) {
+            expected = std::min(expected, distance(j));
+        }
+
+        REQUIRE(tree.nearest(point, dir, distance) == expected);
+    }
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include "grid_index.hpp"
+#include "random_numbers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace {
+
+/// Logarithmic grid similar to eprdata14 energy grids - repeated points at the absorption edges
+std::vector<double> edge_grid(std::size_t size) {
+    std::vector<double> grid;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        grid.push_back(std::pow(10.0, -6.0 + 11.0 * static_cast<double>(i) / (size - 1)));
+        if (i % 97 == 50) {
+            grid.push_back(grid.back());
+        }
+    }
+
+    return grid;
+}
+
+/// Random energies between 1 keV and 10 MeV
+std::vector<double> random_energies(std::size_t count) {
+    uint64_t state = 12345;
+    std::vector<double> energies(count);
+
+    for (double &energy : energies) {
+        energy = std::pow(10.0, -3.0 + 4.0 * projector::prng_double(state));
+    }
+
+    return energies;
+}
+
+std::size_t binary_upper_bound(double x, const std::vector<double> &grid) {
+    return std::distance(grid.begin(), std::upper_bound(grid.begin(), grid.end(), x));
+}
+
+} // namespace
+
+TEST_CASE("Log hash index matches binary search") {
+
+    SECTION("Energy grid") {
+        std::vector<double> grid = edge_grid(2000);
+
+        for (std::size_t bins : {0u, 1u, 7u, 10000u}) {
+            projector::log_grid_index index(grid, bins);
+            REQUIRE_FALSE(index.empty());
+
+            for (double x : random_energies(10000)) {
+                REQUIRE(index.upper_bound(x, grid) == binary_upper_bound(x, grid));
+            }
+
+            // grid points, edges and values outside of the grid
+            for (double x : grid) {
+                REQUIRE(index.upper_bound(x, grid) == binary_upper_bound(x, grid));
+                REQUIRE(index.upper_bound(std::nextafter(x, 0.0), grid) ==
+                        binary_upper_bound(std::nextafter(x, 0.0), grid));
+            }
+            for (double x : {-1.0, 0.0, 1e-9, 1e6}) {
+                REQUIRE(index.upper_bound(x, grid) == binary_upper_bound(x, grid));
+            }
+        }
+    }
+
+    SECTION("Form factor grid starting at zero") {
+        std::vector<double> grid = {0.0, 0.0, 1e-7, 1e-5, 1e-3, 0.1, 0.5, 1.0, 10.0};
+        projector::log_grid_index index(grid);
+
+        for (double x : {-1.0, 0.0, 1e-8, 1e-7, 2e-4, 0.5, 0.7, 10.0, 11.0}) {
+            REQUIRE(index.upper_bound(x, grid) == binary_upper_bound(x, grid));
+        }
+    }
+
+    SECTION("Grid too small for the index") {
+        std::vector<double> grid = {0.0, 1.0};
+        projector::log_grid_index index(grid);
+
+        REQUIRE(index.empty());
+        REQUIRE(index.upper_bound(0.5, grid) == 1);
+    }
+}
+
+TEST_CASE("Energy grid search", "[.benchmark]") {
+
+    std::vector<double> energies = random_energies(100000);
+
+    for (std::size_t size : {500u, 5000u, 50000u}) {
+        std::vector<double> grid = edge_grid(size);
+        projector::log_grid_index index(grid);
+
+        BENCHMARK("binary search, grid " + std::to_string(size)) {
+            std::size_t sum = 0;
+            for (double x : energies) {
+                sum += binary_upper_bound(x, grid);
+            }
+            return sum;
+        };
+
+        BENCHMARK("log hash, grid " + std::to_string(size)) {
+            std::size_t sum = 0;
+            for (double x : energies) {
+                sum += index.upper_bound(x, grid);
+            }
+            return sum;
+        };
+    }
+}
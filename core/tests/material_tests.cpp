@@ -0,0 +1,301 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include "material.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <span>
+#include <vector>
+
+// These tests need the eprdata14 library, they are skipped when PROJECTOR_ACE_XSDIR is not set
+
+namespace {
+
+/// Material from element symbols and atomic fractions
+projector::material_data make_material(double density,
+                                       std::vector<std::pair<const char *, double>> composition) {
+    projector::material_data mat;
+    mat.density = density;
+
+    for (auto [symbol, fraction] : composition) {
+        mat.elements.push_back(symbol_to_atomic_number(symbol));
+        mat.atomic_percentage.push_back(fraction);
+    }
+
+    return mat;
+}
+
+/// Load the materials the same way as the material file loader
+projector::data_library load_materials(const char *xsdir,
+                                       std::vector<projector::material_data> &materials) {
+    projector::data_library library = projector::data_library::load_ace_data(xsdir);
+
+    for (projector::material_data &mat : materials) {
+        library.material_calculate_missing_values(mat);
+    }
+
+    library.load_elements(materials);
+    library.build_union_grid(materials);
+
+    for (projector::material_data &mat : materials) {
+        library.material_build_tables(mat);
+    }
+
+    return library;
+}
+
+/// Water and a lead iron oxide, lead and iron have absorption edges
+std::vector<projector::material_data> test_materials() {
+    return {make_material(0.997, {{"H", 2.0}, {"O", 1.0}}),
+            make_material(8.0, {{"Pb", 1.0}, {"Fe", 1.0}, {"O", 3.0}})};
+}
+
+/// Macroscopic total cross section summed from the element grids
+double reference_macro_xs(const projector::data_library &library,
+                          const projector::material_data &mat, double energy) {
+    double total = 0.0;
+    for (std::size_t i = 0; i < mat.elements.size(); ++i) {
+        total += mat.atom_density[i] *
+                 library.get_element(mat.elements[i]).get_all_cross_sections(energy).total;
+    }
+    return total;
+}
+
+/// Energies of the element grids, the midpoints of their intervals and the ends
+std::vector<double> test_energies(const projector::data_library &library,
+                                  const projector::material_data &mat) {
+    std::vector<double> energies;
+
+    for (std::size_t atomic_number : mat.elements) {
+        std::span<const double> grid = library.get_element(atomic_number).energy_grid();
+
+        for (std::size_t k = 0; k < grid.size(); ++k) {
+            energies.push_back(grid[k]);
+            if (k + 1 < grid.size() && grid[k] != grid[k + 1]) {
+                energies.push_back(0.5 * (grid[k] + grid[k + 1]));
+            }
+        }
+
+        energies.push_back(0.5 * grid.front());
+        energies.push_back(2.0 * grid.back());
+    }
+
+    return energies;
+}
+
+} // namespace
+
+TEST_CASE("Union grid cross sections match the element cross sections") {
+    using Catch::Matchers::WithinRel;
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::vector<projector::material_data> materials = test_materials();
+    projector::data_library library = load_materials(xsdir, materials);
+
+    uint64_t state = 42;
+
+    for (const projector::material_data &mat : materials) {
+        for (double energy : test_energies(library, mat)) {
+            double reference = reference_macro_xs(library, mat, energy);
+
+            REQUIRE_THAT(library.material_macro_xs(mat, energy), WithinRel(reference, 1e-12));
+
+            projector::material_sample sample = library.sample_material(mat, energy, state);
+
+            REQUIRE_THAT(sample.total_macro_xs, WithinRel(reference, 1e-12));
+            REQUIRE_THAT(sample.elem_xs.total,
+                         WithinRel(sample.elem->get_all_cross_sections(energy).total, 1e-12));
+        }
+    }
+}
+
+TEST_CASE("Absorption edges use the cross sections above the edge") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::vector<projector::material_data> materials = test_materials();
+    projector::data_library library = load_materials(xsdir, materials);
+    const projector::material_data &mat = materials[1];
+
+    std::size_t edges = 0;
+
+    for (std::size_t atomic_number : {26, 82}) {
+        const projector::element &elem = library.get_element(atomic_number);
+        std::span<const double> grid = elem.energy_grid();
+        std::span<const double> photoelectric = elem.cross_section_table(3);
+
+        for (std::size_t k = 0; k + 1 < grid.size(); ++k) {
+            if (grid[k] != grid[k + 1]) {
+                continue;
+            }
+
+            // the last copy of the repeated energy holds the value above the edge
+            std::size_t above = k + 1;
+            while (above + 1 < grid.size() && grid[above + 1] == grid[k]) {
+                ++above;
+            }
+
+            double edge = grid[k];
+            REQUIRE(elem.get_cross_section(edge, projector::cross_section::photoelectric) ==
+                    photoelectric[above]);
+            REQUIRE(elem.get_all_cross_sections(edge).photoelectric == photoelectric[above]);
+
+            // the material cross section jumps up at the edge
+            double below = library.material_macro_xs(mat, std::nextafter(edge, 0.0));
+            REQUIRE(library.material_macro_xs(mat, edge) > below);
+
+            edges++;
+            k = above;
+        }
+    }
+
+    // K and L edges of lead and the K edge of iron at least
+    REQUIRE(edges >= 5);
+}
+
+TEST_CASE("Union grid position is clamped to the grid") {
+    using position = std::pair<std::size_t, double>;
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::vector<projector::material_data> materials = test_materials();
+    projector::data_library library = load_materials(xsdir, materials);
+
+    double min_energy = std::numeric_limits<double>::infinity();
+    double max_energy = 0.0;
+
+    for (const projector::material_data &mat : materials) {
+        for (std::size_t atomic_number : mat.elements) {
+            std::span<const double> grid = library.get_element(atomic_number).energy_grid();
+            min_energy = std::min(min_energy, grid.front());
+            max_energy = std::max(max_energy, grid.back());
+        }
+    }
+
+    // below the grid the first point is used
+    REQUIRE(library.union_grid_position(0.5 * min_energy) == position{0, 0.0});
+    REQUIRE(library.union_grid_position(min_energy) == position{0, 0.0});
+
+    // the last point and above it are the end of the last interval
+    auto [last_index, last_t] = library.union_grid_position(max_energy);
+    REQUIRE(last_t == 1.0);
+    REQUIRE(library.union_grid_position(2.0 * max_energy) == position{last_index, 1.0});
+
+    // the grid points inside the grid are the start of their interval
+    const projector::element &lead = library.get_element(82);
+    std::span<const double> grid = lead.energy_grid();
+    std::size_t previous = 0;
+
+    for (std::size_t k = 1; k + 1 < grid.size(); ++k) {
+        if (grid[k] == grid[k + 1]) {
+            continue;
+        }
+
+        auto [index, t] = library.union_grid_position(grid[k]);
+        REQUIRE(t == 0.0);
+        REQUIRE(index > previous);
+        REQUIRE(index <= last_index);
+        previous = index;
+    }
+
+    // the element grids are clamped the same way
+    REQUIRE(lead.get_all_cross_sections(0.5 * grid.front()).total ==
+            lead.get_all_cross_sections(grid.front()).total);
+    REQUIRE(lead.get_all_cross_sections(2.0 * grid.back()).total ==
+            lead.get_all_cross_sections(grid.back()).total);
+}
+
+TEST_CASE("Elements are sampled in proportion to their macroscopic cross sections") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::vector<projector::material_data> materials = test_materials();
+    projector::data_library library = load_materials(xsdir, materials);
+    const projector::material_data &mat = materials[1];
+
+    constexpr std::size_t samples = 200000;
+    uint64_t state = 7;
+
+    // below and above the K edge of lead, and where the scattering dominates
+    for (double energy : {0.05, 0.1, 1.5}) {
+        std::vector<std::size_t> counts(mat.elements.size(), 0);
+
+        for (std::size_t n = 0; n < samples; ++n) {
+            projector::material_sample sample = library.sample_material(mat, energy, state);
+            for (std::size_t i = 0; i < mat.elements.size(); ++i) {
+                counts[i] += sample.elem->atomic_number == mat.elements[i];
+            }
+        }
+
+        double total = library.material_macro_xs(mat, energy);
+
+        for (std::size_t i = 0; i < mat.elements.size(); ++i) {
+            const projector::element &elem = library.get_element(mat.elements[i]);
+            double p = mat.atom_density[i] * elem.get_all_cross_sections(energy).total / total;
+
+            // within 5 standard deviations of the binomial distribution
+            double deviation = 5.0 * std::sqrt(samples * p * (1.0 - p));
+            REQUIRE(std::abs(static_cast<double>(counts[i]) - samples * p) <= deviation);
+        }
+    }
+
+    // the cumulative table does not decrease over the elements of a grid point
+    for (std::size_t u = 0; u < mat.macro_xs_cumulative.size(); u += mat.elements.size()) {
+        REQUIRE(std::is_sorted(mat.macro_xs_cumulative.begin() + u,
+                               mat.macro_xs_cumulative.begin() + u + mat.elements.size()));
+    }
+}
+
+TEST_CASE("Cached material lookups sample the same elements") {
+
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::vector<projector::material_data> materials = test_materials();
+    projector::data_library library = load_materials(xsdir, materials);
+
+    // repeated energies and materials are served from the cache
+    std::vector<std::pair<std::size_t, double>> lookups = {
+        {1, 0.05}, {1, 0.05}, {1, 0.05}, {1, 0.1}, {0, 0.1}, {0, 0.1},
+        {1, 0.1},  {1, 1.5},  {1, 1.5},  {0, 1.5}, {1, 0.1}, {1, 0.1}};
+
+    projector::material_xs_cache cache;
+    uint64_t state = 11;
+    uint64_t cached_state = 11;
+
+    for (std::size_t n = 0; n < 80 * lookups.size(); ++n) {
+        auto [index, energy] = lookups[n % lookups.size()];
+        const projector::material_data &mat = materials[index];
+
+        projector::material_sample sample = library.sample_material(mat, energy, state);
+        projector::material_sample cached =
+            library.sample_material(mat, energy, cached_state, cache);
+
+        REQUIRE(cached.elem == sample.elem);
+        REQUIRE(cached.total_macro_xs == sample.total_macro_xs);
+        REQUIRE(cached.elem_xs.total == sample.elem_xs.total);
+        REQUIRE(cached_state == state);
+    }
+
+    // 5 of the 12 lookups repeat the previous one
+    REQUIRE(cache.hits == 5 * 80);
+    REQUIRE(cache.misses == 7 * 80);
+}
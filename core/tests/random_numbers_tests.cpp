@@ -0,0 +1,44 @@
+#include <catch2/catch_test_macros.hpp>
+#include "random_numbers.hpp"
+
+TEST_CASE("PRNG skip ahead") {
+
+    SECTION("Skip matches sequential stepping") {
+        for (uint64_t delta : {0u, 1u, 2u, 7u, 1000u, 152917u}) {
+            uint64_t sequential = 42;
+            for (uint64_t i = 0; i < delta; ++i) {
+                projector::prng_double(sequential);
+            }
+
+            uint64_t skipped = 42;
+            projector::skip_prng(skipped, delta);
+
+            REQUIRE(skipped == sequential);
+        }
+    }
+
+    SECTION("Skips compose") {
+        uint64_t once = 7;
+        projector::skip_prng(once, 123456789);
+
+        uint64_t twice = 7;
+        projector::skip_prng(twice, 123456000);
+        projector::skip_prng(twice, 789);
+
+        REQUIRE(once == twice);
+    }
+}
+
+TEST_CASE("Particle PRNG streams") {
+
+    uint64_t first = projector::prng_stream_state(20, 0);
+    REQUIRE(first == 20);
+
+    uint64_t third = projector::prng_stream_state(20, 2);
+
+    uint64_t expected = 20;
+    projector::skip_prng(expected, 2 * projector::prng_stream_stride);
+
+    REQUIRE(third == expected);
+    REQUIRE(projector::prng_stream_state(21, 2) != third);
+}
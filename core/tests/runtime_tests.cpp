@@ -0,0 +1,294 @@
+#include <catch2/catch_test_macros.hpp>
+#include "json_loader.hpp"
+#include "random_numbers.hpp"
+#include "runtime.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+namespace {
+
+/// Small simulation - a water slab source below a lead ellipsoid, with void between them
+constexpr const char *engine_main = R"({
+    "name": "engine test",
+    "description": "event and history engine comparison",
+    "save_particle_paths": false,
+    "seed": 7,
+    "energy_cutoff": 0.001,
+    "stack_size": 500,
+    "batch_size": 1000,
+    "tally_accumulation": "deterministic",
+    "bounding_box": [[-6.0, -6.0, -6.0], [6.0, 6.0, 6.0]],
+    "material_file": "materials.json",
+    "object_file": "objects.json",
+    "tally_file": "tallies.json",
+    "output_path": "out"
+})";
+
+constexpr const char *engine_materials = R"({
+    "materials": [
+        {"id": "water", "density": 0.997, "elements": ["H", "O"],
+         "atomic_percentage": [2.0, 1.0]},
+        {"id": "lead", "density": 11.35, "elements": ["Pb"], "atomic_percentage": [1.0]}
+    ]
+})";
+
+constexpr const char *engine_objects = R"({
+    "geometries": {
+        "slab": {
+            "operators": ["intersect"],
+            "surfaces": [{"type": "plane", "parameters": [[0.0, 0.0, -3.0], [0.0, 0.0, 1.0]]}]
+        },
+        "ellipsoid": {
+            "operators": ["intersect"],
+            "surfaces": [{"type": "ellipsoid", "parameters": [[0.0, 0.0, 2.0], 4.0, 3.0, 1.0]}]
+        }
+    },
+    "objects": [
+        {
+            "id": "source",
+            "geometry": "slab",
+            "material_id": "water",
+            "source": {
+                "photon_energy": 0.662,
+                "photon_count": 4000,
+                "direction": [0.0, 0.0, 1.0],
+                "spread": -1.0
+            }
+        },
+        {"id": "shield", "geometry": "ellipsoid", "material_id": "lead"}
+    ]
+})";
+
+constexpr const char *engine_tallies = R"({
+    "filters": [{"id": "generation", "type": "generation", "bins": [0, 1, 1000]}],
+    "tallies": [
+        {"id": "flux", "type": "uniform_mesh", "score": "flux", "filters": ["generation"],
+         "parameters": {"start": [-6, -6, -6], "end": [6, 6, 6], "resolution": [8, 8, 8]}},
+        {"id": "energy", "type": "uniform_mesh", "score": "average_energy",
+         "parameters": {"start": [-6, -6, -6], "end": [6, 6, 6], "resolution": [8, 8, 8]}},
+        {"id": "counts", "type": "uniform_mesh", "score": "interaction_counts",
+         "parameters": {"start": [-6, -6, -6], "end": [6, 6, 6], "resolution": [8, 8, 8]}},
+        {"id": "deposit", "type": "uniform_mesh", "score": "deposited_energy",
+         "parameters": {"start": [-6, -6, -6], "end": [6, 6, 6], "resolution": [5, 5, 5]}}
+    ]
+})";
+
+/// Write the input files of the engine simulation into an empty directory
+void write_engine_files(const std::filesystem::path &dir) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    for (auto [name, content] : {std::pair{"main.json", engine_main},
+                                 {"materials.json", engine_materials},
+                                 {"objects.json", engine_objects},
+                                 {"tallies.json", engine_tallies}}) {
+        std::ofstream(dir / name) << content;
+    }
+}
+
+/// Load the simulation of a directory
+void load_engine(const std::filesystem::path &dir, const char *xsdir,
+                 projector::environment &env) {
+    env.cross_section_data = projector::data_library::load_ace_data(xsdir);
+
+    projector::load_simulation_data(dir / "main.json", env);
+    projector::load_material_data(dir / "materials.json", env);
+    projector::load_object_data(dir / "objects.json", env);
+    projector::load_tally_data(dir / "tallies.json", env);
+}
+
+/// Run the simulation of a directory with an engine, the tallies are saved into the out directory
+void run_engine(const std::filesystem::path &dir, const char *xsdir, bool event) {
+    projector::environment env;
+    load_engine(dir, xsdir, env);
+
+    // several transport passes in each batch
+    env.tally_flush_particles = 300;
+
+    projector::initialize_runtime(env, 2);
+
+    while (projector::source_batch(env)) {
+        if (event) {
+            projector::calculate_particle_events(env);
+        } else {
+            projector::calculate_particle_histories(env);
+        }
+        projector::finish_batch(env);
+    }
+
+    projector::process_tallies(env);
+    projector::save_data(env);
+}
+
+std::string read_file(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+/// Environment without sources, the batches are scored by the test itself
+projector::environment batch_environment(std::size_t total_particles, double target_error) {
+    projector::environment env;
+
+    env.save_particle_paths = false;
+    env.batch_size = 1000;
+    env.target_relative_error = target_error;
+    env.convergence_score_fraction = 0.0;
+    env.total_particles = total_particles;
+    env.sourced_particles = 0;
+    env.batch_count = 0;
+
+    env.tallies.push_back(std::make_unique<projector::uniform_mesh_tally>(
+        "convergence_test", projector::vec3(0.0, 0.0, 0.0), projector::vec3(10.0, 10.0, 10.0),
+        projector::coord3(1, 1, 1), projector::tally_score::deposited_energy));
+    env.tallies.back()->init_tally();
+    env.convergence_tallies = {0};
+
+    return env;
+}
+
+/// Run the batches, each particle deposits a random energy into the single cell
+void run_batches(projector::environment &env) {
+    uint64_t state = 1234;
+
+    while (projector::source_batch(env)) {
+        for (std::size_t i = 0; i < env.batch_particles; ++i) {
+            double energy = projector::prng_double(state);
+            env.tallies[0]->score_step({.start = {5.0, 5.0, 5.0},
+                                        .end = {5.0, 5.0, 5.0},
+                                        .energy = energy,
+                                        .end_energy = 0.0,
+                                        .interaction = projector::cross_section::photoelectric,
+                                        .element = 8});
+        }
+
+        if (projector::finish_batch(env)) {
+            break;
+        }
+    }
+}
+
+} // namespace
+
+TEST_CASE("Batches stop once the target relative error is reached") {
+
+    // the relative error of a single batch mean is about 0.58 / sqrt(1000), so the target is
+    // reached after about 14 batches
+    projector::environment env = batch_environment(200000, 0.005);
+    run_batches(env);
+
+    REQUIRE(env.batch_count >= 2);
+    REQUIRE(env.sourced_particles < env.total_particles);
+    REQUIRE(env.sourced_particles == env.batch_count * env.batch_size);
+    REQUIRE(env.tallies[0]->relative_error(0.0) <= 0.005);
+
+    // the saved run records the particles the tallies are summed over
+    env.output_path = std::filesystem::temp_directory_path() / "projector_batch_test";
+    projector::process_tallies(env);
+    projector::save_data(env);
+
+    nlohmann::json run = nlohmann::json::parse(read_file(env.output_path / "run.json"));
+    REQUIRE(run["sourced_particles"] == env.sourced_particles);
+    REQUIRE(run["total_particles"] == env.total_particles);
+    REQUIRE(run["batch_count"] == env.batch_count);
+
+    std::filesystem::remove_all(env.output_path);
+
+    // without a target all particles are run
+    projector::environment full = batch_environment(20000, 0.0);
+    run_batches(full);
+
+    REQUIRE(full.sourced_particles == full.total_particles);
+    REQUIRE(full.batch_count == 20);
+}
+
+TEST_CASE("Event engine gives the same tallies as the history engine") {
+
+    // needs the eprdata14 library
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "projector_engine_test";
+    write_engine_files(dir);
+
+    run_engine(dir, xsdir, false);
+    std::filesystem::rename(dir / "out", dir / "history");
+
+    run_engine(dir, xsdir, true);
+
+    // the particles follow the same histories, and the deterministic accumulation does not
+    // depend on the order of the scores, so the tallies and their statistics are identical
+    for (const char *id : {"flux", "energy", "counts", "deposit"}) {
+        std::string history = read_file(dir / "history" / "tallies" / (std::string(id) + ".csv"));
+        std::string event = read_file(dir / "out" / "tallies" / (std::string(id) + ".csv"));
+
+        REQUIRE(history.find("rel_err0") != std::string::npos);
+        REQUIRE(event == history);
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Material cache counters match the particle histories") {
+
+    // needs the eprdata14 library
+    const char *xsdir = std::getenv("PROJECTOR_ACE_XSDIR");
+    if (xsdir == nullptr) {
+        SKIP("PROJECTOR_ACE_XSDIR is not set");
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "projector_cache_test";
+    write_engine_files(dir);
+
+    projector::environment env;
+    load_engine(dir, xsdir, env);
+
+    // the histories of the first batch are kept in memory, the batch is not finished so no
+    // tracks are written
+    env.save_particle_paths = true;
+    projector::initialize_runtime(env, 2);
+
+    REQUIRE(projector::source_batch(env));
+    projector::calculate_particle_histories(env);
+
+    // each flight through an object follows one material lookup, the lookup is reused when the
+    // previous lookup of the particle had the same material and energy
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+
+    for (const projector::particle &p : env.particles) {
+        std::size_t material = projector::no_object;
+        double energy = 0.0;
+
+        for (std::size_t k = 1; k < p.history.points.size(); ++k) {
+            projector::particle_step step = p.step(k);
+            if (step.object == projector::no_object) {
+                continue;
+            }
+
+            std::size_t step_material = env.objects[step.object].material_id;
+            if (step_material == material && step.energy == energy) {
+                hits++;
+            } else {
+                misses++;
+            }
+
+            material = step_material;
+            energy = step.energy;
+        }
+    }
+
+    REQUIRE(env.xs_cache_misses == misses);
+    REQUIRE(env.xs_cache_hits == hits);
+
+    // the surface crossings and the coherent scattering reuse the lookups
+    REQUIRE(hits > 0);
+
+    std::filesystem::remove_all(dir);
+}
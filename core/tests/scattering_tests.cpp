@@ -0,0 +1,157 @@
+#include <catch2/catch_test_macros.hpp>
+#include "constants.hpp"
+#include "material.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <sstream>
+
+namespace {
+
+/// ACE text of a synthetic element. The form factors have a realistic shape, the coherent one
+/// falls off as F^2 = Z^2 / (1 + a x)^2 and the incoherent one rises as S = Z (1 - exp(-b x)).
+std::string synthetic_element(int z) {
+    constexpr std::size_t n_y = 100;
+    constexpr std::size_t n_inc = 60;
+    constexpr std::size_t n_coh = 80;
+
+    constexpr double a = 1e5;
+    constexpr double b = 1e5;
+
+    std::ostringstream text;
+    text.precision(17);
+
+    text << z << "000.14p 1.0 1.0E-12 01/01/14\n";
+    for (int i = 0; i < 5; ++i) {
+        text << "header\n";
+    }
+
+    std::size_t jxs1 = 1 + 5 * n_y;
+    std::size_t jxs2 = jxs1 + 2 * n_inc;
+    std::size_t jxs3 = jxs2 + 3 * n_coh;
+
+    std::array<std::size_t, 16> nxs = {5 * n_y + 2 * n_inc + 3 * n_coh, std::size_t(z), n_y};
+    std::array<std::size_t, 32> jxs = {1, jxs1, jxs2, jxs3};
+
+    for (std::size_t value : nxs) {
+        text << value << " ";
+    }
+    for (std::size_t value : jxs) {
+        text << value << " ";
+    }
+    text << "\n";
+
+    // logarithms of the energies and of the cross sections
+    for (std::size_t i = 0; i < n_y; ++i) {
+        text << std::log(std::pow(10.0, -3.0 + 5.0 * i / (n_y - 1))) << " ";
+    }
+    for (std::size_t i = 0; i < 4 * n_y; ++i) {
+        text << std::log(1.0 + z) << " ";
+    }
+
+    auto grid = [](std::size_t i, std::size_t count) {
+        return i == 0 ? 0.0 : std::pow(10.0, -9.0 + 8.0 * (i - 1) / (count - 2));
+    };
+
+    for (std::size_t i = 0; i < n_inc; ++i) {
+        text << grid(i, n_inc) << " ";
+    }
+    for (std::size_t i = 0; i < n_inc; ++i) {
+        text << z * (1.0 - std::exp(-b * grid(i, n_inc))) << " ";
+    }
+
+    for (std::size_t i = 0; i < n_coh; ++i) {
+        text << grid(i, n_coh) << " ";
+    }
+    for (std::size_t i = 0; i < n_coh; ++i) {
+        double x = grid(i, n_coh);
+        text << z * z * x / (1.0 + a * x) << " ";
+    }
+    for (std::size_t i = 0; i < n_coh; ++i) {
+        double x = grid(i, n_coh);
+        text << z * z / std::pow(1.0 + a * x, 2) << " ";
+    }
+
+    return text.str();
+}
+
+/// Two sample Kolmogorov-Smirnov statistic
+double ks_distance(std::vector<double> a, std::vector<double> b) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+
+    double distance = 0.0;
+    std::size_t i = 0;
+    std::size_t j = 0;
+
+    while (i < a.size() && j < b.size()) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else {
+            ++j;
+        }
+        distance = std::max(distance, std::abs(static_cast<double>(i) / a.size() -
+                                               static_cast<double>(j) / b.size()));
+    }
+
+    return distance;
+}
+
+template <typename F>
+std::vector<double> draw(std::size_t count, uint64_t seed, F sampler) {
+    std::vector<double> samples(count);
+    for (double &sample : samples) {
+        sample = sampler(seed);
+    }
+    return samples;
+}
+
+constexpr std::size_t sample_count = 100000;
+
+/// Far above the critical value of the KS test for the sample count
+constexpr double max_ks_distance = 0.01;
+
+} // namespace
+
+TEST_CASE("Tabulated Rayleigh sampling matches rejection sampling") {
+
+    projector::element elem = projector::element::load_from_ace_text(synthetic_element(82));
+    elem.build_sampling_tables();
+
+    for (double energy : {0.005, 0.05, 0.662, 7.5}) {
+        std::vector<double> tabulated = draw(sample_count, 1, [&](uint64_t &state) {
+            return elem.rayleigh(energy, state);
+        });
+        std::vector<double> reference = draw(sample_count, 2, [&](uint64_t &state) {
+            return elem.rayleigh_rejection(energy, state);
+        });
+
+        INFO("energy " << energy);
+        REQUIRE(ks_distance(tabulated, reference) < max_ks_distance);
+    }
+}
+
+TEST_CASE("Tabulated Compton sampling matches rejection sampling") {
+
+    projector::element elem = projector::element::load_from_ace_text(synthetic_element(82));
+    elem.build_sampling_tables();
+
+    for (double energy : {0.005, 0.05, 0.662, 7.5}) {
+        std::vector<double> tabulated = draw(sample_count, 1, [&](uint64_t &state) {
+            return elem.compton(energy, state).second;
+        });
+        std::vector<double> reference = draw(sample_count, 2, [&](uint64_t &state) {
+            return elem.compton_rejection(energy, state).second;
+        });
+
+        INFO("energy " << energy);
+        REQUIRE(ks_distance(tabulated, reference) < max_ks_distance);
+
+        // the outgoing energy follows from the cosine
+        uint64_t state = 3;
+        auto [energy_out, mu] = elem.compton(energy, state);
+        double k = energy / projector::constants::electron_mass_ev;
+        REQUIRE(energy_out == projector::constants::electron_mass_ev * k / (1.0 + k * (1.0 - mu)));
+    }
+}
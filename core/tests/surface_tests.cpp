@@ -54,4 +54,69 @@ TEST_CASE("Z cone") {
 
     projector::y_cone cone({1.0, 1.0, 1.0}, 3.0, 2.0, 1.0);
 
-}
\ No newline at end of file
+}
+TEST_CASE("General quadric") {
+    using Catch::Matchers::WithinAbs;
+
+    SECTION("Axis aligned cylinder") {
+        // (x - 1)^2 / 4 + (y - 1)^2 / 9 - 1 = 0, same as the z cylinder
+        projector::quadric quad({1.0, 1.0, 1.0}, {0.25, 1.0 / 9.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+                                                 0.0, -1.0});
+        projector::z_cylinder cyl({1.0, 1.0, 1.0}, 2.0, 3.0);
+
+        projector::vec3 dir = projector::vec3{1.0, 2.0, 3.0}.normalized();
+
+        for (double x = -4.0; x <= 4.0; x += 0.7) {
+            for (double y = -4.0; y <= 4.0; y += 0.9) {
+                projector::vec3 p = {x, y, 0.5};
+                REQUIRE(quad.point_inside(p) == cyl.point_inside(p));
+                REQUIRE_THAT(quad.distance_along_line(p, dir),
+                             WithinAbs(cyl.distance_along_line(p, dir), 1e-9));
+            }
+        }
+    }
+
+    SECTION("Rotated cylinder") {
+        // axis along (1, 1, 0) / sqrt(2) through the origin, radius 2
+        projector::quadric quad({0.0, 0.0, 0.0}, {0.5, 0.5, 1.0, -1.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+                                                 -4.0});
+
+        REQUIRE(quad.point_inside({5.0, 5.0, 0.0}));
+        REQUIRE(quad.point_inside({-3.0, -2.0, 1.0}));
+        REQUIRE_FALSE(quad.point_inside({0.0, 0.0, 2.5}));
+        REQUIRE_FALSE(quad.point_inside({2.0, -2.0, 0.0}));
+
+        // from a point on the axis, perpendicular to it
+        projector::vec3 dir = projector::vec3{1.0, -1.0, 0.0}.normalized();
+        REQUIRE_THAT(quad.distance_along_line({3.0, 3.0, 0.0}, dir), WithinAbs(2.0, 1e-12));
+        REQUIRE_THAT(quad.distance_along_line({3.0, 3.0, 0.0}, {0.0, 0.0, -1.0}),
+                     WithinAbs(2.0, 1e-12));
+    }
+}
+
+TEST_CASE("Box") {
+    using Catch::Matchers::WithinAbs;
+
+    projector::box box({-1.0, -2.0, -3.0}, {1.0, 2.0, 3.0});
+
+    REQUIRE(box.point_inside({0.0, 0.0, 0.0}));
+    REQUIRE(box.point_inside({0.9, -1.9, 2.9}));
+    REQUIRE_FALSE(box.point_inside({1.1, 0.0, 0.0}));
+    REQUIRE_FALSE(box.point_inside({0.0, 0.0, -3.0}));
+
+    // from inside, the exit face
+    REQUIRE_THAT(box.distance_along_line({0.0, 0.0, 0.0}, {0.0, 1.0, 0.0}), WithinAbs(2.0, 1e-12));
+    REQUIRE_THAT(box.distance_along_line({0.5, 0.0, 0.0}, {-1.0, 0.0, 0.0}),
+                 WithinAbs(1.5, 1e-12));
+
+    // from outside, the entry face
+    projector::vec3 dir = projector::vec3{-1.0, 0.0, 1.0}.normalized();
+    REQUIRE_THAT(box.distance_along_line({3.0, 0.0, 0.0}, dir),
+                 WithinAbs(2.0 * std::sqrt(2.0), 1e-12));
+
+    // missed or behind
+    REQUIRE(box.distance_along_line({3.0, 0.0, 0.0}, {0.0, 1.0, 0.0}) ==
+            projector::constants::infinity);
+    REQUIRE(box.distance_along_line({3.0, 0.0, 0.0}, {1.0, 0.0, 0.0}) ==
+            projector::constants::infinity);
+}
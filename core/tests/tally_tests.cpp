@@ -0,0 +1,583 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include "constants.hpp"
+#include "random_numbers.hpp"
+#include "tally.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include <omp.h>
+
+namespace {
+
+using projector::vec3;
+
+/// Random steps inside of the 10 cm cube, short flights ending in a random interaction
+std::vector<projector::particle_step> random_steps(std::size_t count) {
+    uint64_t state = 4242;
+    std::vector<projector::particle_step> steps(count);
+
+    for (auto &step : steps) {
+        vec3 start(10.0 * projector::prng_double(state), 10.0 * projector::prng_double(state),
+                   10.0 * projector::prng_double(state));
+        vec3 direction(projector::prng_double(state) - 0.5, projector::prng_double(state) - 0.5,
+                       projector::prng_double(state) - 0.5);
+
+        step.start = start;
+        step.end = start + 3.0 * projector::prng_double(state) * direction.normalized();
+        step.energy = 0.01 + 0.09 * projector::prng_double(state);
+        step.end_energy = step.energy * projector::prng_double(state);
+        step.interaction = static_cast<projector::cross_section>(
+            1 + static_cast<int>(4.0 * projector::prng_double(state)));
+        step.element = 8;
+    }
+
+    return steps;
+}
+
+projector::particle_step segment(const vec3 &start, const vec3 &end) {
+    return {.start = start,
+            .end = end,
+            .energy = 1.0,
+            .end_energy = 1.0,
+            .interaction = projector::cross_section::no_interaction,
+            .element = 0};
+}
+
+/// Photoelectric absorption of a particle of the given energy at a point
+projector::particle_step absorption(const vec3 &point, double energy) {
+    return {.start = point,
+            .end = point,
+            .energy = energy,
+            .end_energy = 0.0,
+            .interaction = projector::cross_section::photoelectric,
+            .element = 8};
+}
+
+/// Read a saved tally and remove the file
+/// @return all values after the header, row by row
+std::vector<double> read_tally(const std::filesystem::path &file_path) {
+    std::ifstream file(file_path);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // all values after the header, separated by commas and line ends
+    std::vector<double> values;
+    const char *position = content.c_str() + content.find('\n');
+
+    while (position[1] != '\0') {
+        char *next;
+        values.push_back(std::strtod(position + 1, &next));
+        position = next;
+    }
+
+    std::filesystem::remove(file_path);
+
+    return values;
+}
+
+/// Score the steps in batches, save the tally and return the values of the saved file
+template <typename Real>
+std::vector<double>
+run_tally(projector::tally_score score, const std::vector<projector::particle_step> &steps,
+          std::size_t batch_count, int resolution = 8,
+          projector::tally_accumulation accumulation = projector::tally_accumulation::atomic,
+          int threads = 1) {
+    std::string id = "precision_test_" + std::to_string(sizeof(Real));
+
+    // the private accumulations allocate a buffer for each thread
+    omp_set_num_threads(threads);
+
+    projector::basic_uniform_mesh_tally<Real> tally(id, {0.0, 0.0, 0.0}, {10.0, 10.0, 10.0},
+                                                    {resolution, resolution, resolution}, score,
+                                                    accumulation);
+    tally.init_tally();
+
+    std::size_t batch_size = steps.size() / batch_count;
+
+    for (std::size_t batch = 0; batch < batch_count; ++batch) {
+        std::size_t first = batch * batch_size;
+
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (std::size_t i = first; i < first + batch_size; ++i) {
+            tally.score_step(steps[i]);
+        }
+        tally.end_batch(batch_size);
+    }
+
+    tally.finalize_data();
+
+    std::filesystem::path path = std::filesystem::temp_directory_path();
+    tally.save_tally(path);
+
+    return read_tally(path / (id + ".csv"));
+}
+
+} // namespace
+
+TEST_CASE("Mesh traversal scores the track length of each cell") {
+
+    // 4 x 4 x 4 cells of 2.5 cm, random steps partly outside of the mesh
+    std::vector<projector::particle_step> steps = random_steps(50);
+    for (auto &step : steps) {
+        step.start = 1.4 * step.start - vec3(2.0, 2.0, 2.0);
+        step.end = 1.4 * step.end - vec3(2.0, 2.0, 2.0);
+    }
+
+    // axis aligned steps along the cell boundaries and a step inside of a single cell
+    steps.push_back(segment({-1.0, 5.0, 2.5}, {11.0, 5.0, 2.5}));
+    steps.push_back(segment({7.5, 12.0, 7.5}, {7.5, 3.0, 7.5}));
+    steps.push_back(segment({1.0, 1.0, 1.0}, {1.5, 2.0, 1.2}));
+
+    constexpr int res = 4;
+    constexpr double cell_size = 10.0 / res;
+    constexpr double cell_volume = cell_size * cell_size * cell_size;
+    constexpr std::size_t subdivisions = 100000;
+
+    for (const auto &step : steps) {
+        std::vector<double> values =
+            run_tally<double>(projector::tally_score::flux, {step}, 1, res);
+        REQUIRE(values.size() == 4 * res * res * res);
+
+        // reference by midpoint sampling of fine subsegments
+        std::vector<double> reference(res * res * res, 0.0);
+        vec3 dir = step.end - step.start;
+        double sub_length = dir.norm() / subdivisions;
+
+        for (std::size_t k = 0; k < subdivisions; ++k) {
+            vec3 point = step.start + (k + 0.5) / subdivisions * dir;
+            if ((point.array() < 0.0).any() || (point.array() >= 10.0).any()) {
+                continue;
+            }
+            vec3 cell = (point / cell_size).array().floor();
+            reference[(cell.z() * res + cell.y()) * res + cell.x()] += sub_length;
+        }
+
+        for (std::size_t i = 0; i < reference.size(); ++i) {
+            REQUIRE(std::abs(values[4 * i + 3] * cell_volume - reference[i]) <= 2.0 * sub_length);
+        }
+    }
+}
+
+TEST_CASE("Batch statistics give the relative error of the batch means") {
+
+    using projector::constants::infinity;
+
+    projector::uniform_mesh_tally tally("batch_test", {0.0, 0.0, 0.0}, {10.0, 10.0, 10.0},
+                                        {2, 2, 2}, projector::tally_score::deposited_energy);
+    tally.init_tally();
+
+    // a well scored cell and a rarely scored cell, one particle per batch
+    std::vector<double> first_cell = {1.0, 2.0, 3.0, 4.0};
+    std::vector<double> second_cell = {0.01, 0.0, 0.0, 0.03};
+
+    REQUIRE(tally.relative_error(0.0) == infinity);
+
+    for (std::size_t batch = 0; batch < first_cell.size(); ++batch) {
+        tally.score_step(absorption({1.0, 1.0, 1.0}, first_cell[batch]));
+        if (second_cell[batch] != 0.0) {
+            tally.score_step(absorption({6.0, 1.0, 1.0}, second_cell[batch]));
+        }
+        tally.end_batch(1);
+
+        if (batch == 0) {
+            REQUIRE(tally.relative_error(0.0) == infinity);
+        }
+    }
+
+    // standard deviation of the mean of the batch values over the mean
+    auto expected_error = [](const std::vector<double> &batches) {
+        double n = static_cast<double>(batches.size());
+        double mean = 0.0;
+        for (double value : batches) {
+            mean += value / n;
+        }
+        double variance = 0.0;
+        for (double value : batches) {
+            variance += (value - mean) * (value - mean) / (n - 1.0);
+        }
+        return std::sqrt(variance / n) / mean;
+    };
+
+    double first_error = expected_error(first_cell);
+    double second_error = expected_error(second_cell);
+    REQUIRE(second_error > first_error);
+
+    // the noisy cell decides, unless it is below the score fraction
+    REQUIRE(std::abs(tally.relative_error(0.0) - second_error) <= 1e-9 * second_error);
+    REQUIRE(std::abs(tally.relative_error(0.1) - first_error) <= 1e-9 * first_error);
+
+    tally.finalize_data();
+    tally.save_tally(std::filesystem::temp_directory_path());
+
+    // x, y, z, data0, rel_err0 of all cells, unscored cells have infinite errors
+    std::vector<double> values =
+        read_tally(std::filesystem::temp_directory_path() / "batch_test.csv");
+    REQUIRE(values.size() == 8 * 5);
+
+    REQUIRE(std::abs(values[3] - 10.0) <= 1e-12);
+    REQUIRE(std::abs(values[4] - first_error) <= 1e-9 * first_error);
+    REQUIRE(std::abs(values[5 + 3] - 0.04) <= 1e-12);
+    REQUIRE(std::abs(values[5 + 4] - second_error) <= 1e-9 * second_error);
+    REQUIRE(values[2 * 5 + 4] == infinity);
+}
+
+TEST_CASE("Float tally accumulators match the double tally") {
+
+    std::vector<projector::particle_step> steps = random_steps(200000);
+
+    for (auto score : {projector::tally_score::flux, projector::tally_score::average_energy,
+                       projector::tally_score::interaction_counts,
+                       projector::tally_score::deposited_energy}) {
+
+        std::vector<double> single = run_tally<float>(score, steps, 4);
+        std::vector<double> reference = run_tally<double>(score, steps, 4);
+
+        REQUIRE(single.size() == reference.size());
+        REQUIRE_FALSE(reference.empty());
+
+        for (std::size_t i = 0; i < reference.size(); ++i) {
+            REQUIRE(std::abs(single[i] - reference[i]) <= 1e-4 * std::abs(reference[i]));
+        }
+    }
+}
+
+TEST_CASE("Float tally accumulators are flushed within a single batch") {
+
+    // a single batch with millions of small scores in one cell, an unflushed float sum rounds
+    // each of them to the coarse resolution of the large sum
+    constexpr std::size_t step_count = std::size_t(1) << 22;
+    constexpr std::size_t flush_steps = 65536;
+
+    projector::basic_uniform_mesh_tally<float> flushed(
+        "flush_test", {0.0, 0.0, 0.0}, {10.0, 10.0, 10.0}, {1, 1, 1},
+        projector::tally_score::deposited_energy);
+    projector::basic_uniform_mesh_tally<float> unflushed(
+        "unflushed_test", {0.0, 0.0, 0.0}, {10.0, 10.0, 10.0}, {1, 1, 1},
+        projector::tally_score::deposited_energy);
+    flushed.init_tally();
+    unflushed.init_tally();
+
+    uint64_t state = 99;
+    double reference = 0.0;
+
+    for (std::size_t i = 0; i < step_count; ++i) {
+        double energy = 0.001 * (1.0 + projector::prng_double(state));
+        reference += static_cast<double>(static_cast<float>(energy));
+
+        flushed.score_step(absorption({5.0, 5.0, 5.0}, energy));
+        unflushed.score_step(absorption({5.0, 5.0, 5.0}, energy));
+
+        // the runtime flushes the tallies after each transport pass
+        if ((i + 1) % flush_steps == 0) {
+            flushed.flush_scores();
+        }
+    }
+
+    flushed.finalize_data();
+    unflushed.finalize_data();
+
+    std::filesystem::path path = std::filesystem::temp_directory_path();
+    flushed.save_tally(path);
+    unflushed.save_tally(path);
+
+    // x, y, z, data0 of the single cell
+    std::vector<double> flushed_values = read_tally(path / "flush_test.csv");
+    std::vector<double> unflushed_values = read_tally(path / "unflushed_test.csv");
+    REQUIRE(flushed_values.size() == 4);
+    REQUIRE(unflushed_values.size() == 4);
+
+    REQUIRE(std::abs(flushed_values[3] - reference) <= 1e-5 * reference);
+    REQUIRE(std::abs(unflushed_values[3] - reference) > 1e-5 * reference);
+}
+
+TEST_CASE("Private tally accumulations match the atomic accumulation") {
+
+    using projector::tally_accumulation;
+    using projector::tally_score;
+
+    std::vector<projector::particle_step> steps = random_steps(100000);
+
+    // dense buffers for the coarse mesh, the interaction counts of the fine mesh are too large and
+    // allocate the pages on first use
+    for (auto [score, resolution] : {std::pair{tally_score::flux, 8},
+                                     {tally_score::deposited_energy, 8},
+                                     {tally_score::interaction_counts, 8},
+                                     {tally_score::interaction_counts, 80}}) {
+        std::vector<double> atomic =
+            run_tally<double>(score, steps, 2, resolution, tally_accumulation::atomic, 4);
+        std::vector<double> thread_private = run_tally<double>(
+            score, steps, 2, resolution, tally_accumulation::thread_private, 4);
+        std::vector<double> single_thread =
+            run_tally<double>(score, steps, 2, resolution, tally_accumulation::deterministic);
+        std::vector<double> deterministic = run_tally<double>(
+            score, steps, 2, resolution, tally_accumulation::deterministic, 4);
+
+        REQUIRE(thread_private.size() == atomic.size());
+        REQUIRE(deterministic.size() == atomic.size());
+
+        // the relative errors of cells with equal batch values are only rounding noise, cells
+        // without scores have infinite relative errors
+        auto close = [](double value, double expected) {
+            return value == expected ||
+                   std::abs(value - expected) <= 1e-6 * std::abs(expected) + 1e-6;
+        };
+
+        std::size_t private_mismatches = 0;
+        std::size_t deterministic_mismatches = 0;
+        std::size_t thread_count_mismatches = 0;
+
+        for (std::size_t i = 0; i < atomic.size(); ++i) {
+            private_mismatches += !close(thread_private[i], atomic[i]);
+            deterministic_mismatches += !close(deterministic[i], atomic[i]);
+
+            // independent of the thread count
+            thread_count_mismatches += deterministic[i] != single_thread[i];
+        }
+
+        REQUIRE(private_mismatches == 0);
+        REQUIRE(deterministic_mismatches == 0);
+        REQUIRE(thread_count_mismatches == 0);
+    }
+}
+
+TEST_CASE("Deterministic accumulation reports fixed point overflows") {
+
+    omp_set_num_threads(1);
+
+    auto make_tally = [] {
+        auto tally = std::make_unique<projector::uniform_mesh_tally>(
+            "overflow_test", vec3(0.0, 0.0, 0.0), vec3(10.0, 10.0, 10.0),
+            projector::coord3(2, 2, 2), projector::tally_score::deposited_energy,
+            projector::tally_accumulation::deterministic);
+        tally->init_tally();
+        return tally;
+    };
+
+    // a sum close to the end of the range
+    auto in_range = make_tally();
+    in_range->score_step(absorption({1.0, 1.0, 1.0}, 1.0e9));
+    in_range->score_step(absorption({1.0, 1.0, 1.0}, 1.0e9));
+    REQUIRE_NOTHROW(in_range->end_batch(1));
+
+    // a single score and a sum out of range
+    auto single = make_tally();
+    single->score_step(absorption({1.0, 1.0, 1.0}, 3.0e9));
+    REQUIRE_THROWS_AS(single->end_batch(1), std::runtime_error);
+
+    auto sum = make_tally();
+    sum->score_step(absorption({1.0, 1.0, 1.0}, 1.5e9));
+    sum->score_step(absorption({1.0, 1.0, 1.0}, 1.5e9));
+    REQUIRE_THROWS_AS(sum->end_batch(1), std::runtime_error);
+}
+
+TEST_CASE("Fused scoring matches scoring each tally") {
+
+    using projector::tally_score;
+
+    std::vector<projector::particle_step> steps = random_steps(20000);
+
+    // three tallies share a mesh, the last one has its own
+    auto make_tallies = [] {
+        std::vector<std::unique_ptr<projector::tally>> tallies;
+        for (auto score : {tally_score::flux, tally_score::average_energy,
+                           tally_score::interaction_counts, tally_score::deposited_energy}) {
+            int res = score == tally_score::deposited_energy ? 5 : 8;
+            tallies.push_back(std::make_unique<projector::uniform_mesh_tally>(
+                "fused_" + std::to_string(static_cast<int>(score)), vec3(0.0, 0.0, 0.0),
+                vec3(10.0, 10.0, 10.0), projector::coord3(res, res, res), score));
+            tallies.back()->init_tally();
+        }
+        return tallies;
+    };
+
+    auto fused = make_tallies();
+    auto separate = make_tallies();
+
+    projector::tally_scorer scorer(fused);
+
+    for (const auto &step : steps) {
+        scorer.score_step(step);
+        for (auto &tally : separate) {
+            tally->score_step(step);
+        }
+    }
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "projector_fused_test";
+
+    for (auto *tallies : {&fused, &separate}) {
+        std::filesystem::create_directories(path / (tallies == &fused ? "fused" : "separate"));
+        for (auto &tally : *tallies) {
+            tally->finalize_data();
+            tally->save_tally(path / (tallies == &fused ? "fused" : "separate"));
+        }
+    }
+
+    for (const auto &entry : std::filesystem::directory_iterator(path / "separate")) {
+        std::ifstream separate_file(entry.path());
+        std::ifstream fused_file(path / "fused" / entry.path().filename());
+
+        std::string separate_content((std::istreambuf_iterator<char>(separate_file)),
+                                     std::istreambuf_iterator<char>());
+        std::string fused_content((std::istreambuf_iterator<char>(fused_file)),
+                                  std::istreambuf_iterator<char>());
+
+        REQUIRE_FALSE(separate_content.empty());
+        REQUIRE(fused_content == separate_content);
+    }
+
+    std::filesystem::remove_all(path);
+}
+
+TEST_CASE("Filters split the tally scores into their bins") {
+
+    using projector::filter_type;
+    using projector::tally_filter;
+    using projector::tally_score;
+
+    std::vector<projector::particle_step> steps = random_steps(20000);
+    for (std::size_t i = 0; i < steps.size(); ++i) {
+        steps[i].generation = i % 4;
+    }
+
+    // the energy bins cover all steps, the generation bins all but the third generation, the
+    // interaction bins leave out the pair production
+    std::vector<std::unique_ptr<tally_filter>> filters;
+    filters.push_back(std::make_unique<tally_filter>(
+        tally_filter{"energy", filter_type::energy, 0, 3, {0.01, 0.04, 0.07, 0.1}, {}}));
+    filters.push_back(std::make_unique<tally_filter>(
+        tally_filter{"generation", filter_type::generation, 1, 2, {0.0, 1.0, 3.0}, {}}));
+    filters.push_back(std::make_unique<tally_filter>(
+        tally_filter{"interaction", filter_type::interaction, 2, 2, {}, {-1, 0, 1, 1, -1}}));
+
+    constexpr int res = 5;
+    constexpr std::size_t cells = res * res * res;
+
+    projector::coord3 resolution(res, res, res);
+
+    std::vector<std::unique_ptr<projector::tally>> tallies;
+    auto add_tally = [&](std::string id, tally_score score,
+                         std::vector<const tally_filter *> tally_filters) {
+        tallies.push_back(std::make_unique<projector::uniform_mesh_tally>(
+            id, vec3(0.0, 0.0, 0.0), vec3(10.0, 10.0, 10.0), resolution, score,
+            projector::tally_accumulation::atomic, tally_filters));
+        tallies.back()->init_tally();
+    };
+
+    add_tally("filter_deposit", tally_score::deposited_energy, {});
+    add_tally("filter_deposit_split", tally_score::deposited_energy,
+              {filters[0].get(), filters[1].get()});
+    add_tally("filter_counts", tally_score::interaction_counts, {});
+    add_tally("filter_counts_split", tally_score::interaction_counts, {filters[2].get()});
+
+    projector::tally_scorer scorer(tallies, filters);
+
+    for (const auto &step : steps) {
+        scorer.score_step(step);
+    }
+
+    std::filesystem::path path = std::filesystem::temp_directory_path();
+
+    for (auto &tally : tallies) {
+        tally->finalize_data();
+        tally->save_tally(path);
+    }
+
+    std::vector<double> deposit = read_tally(path / "filter_deposit.csv");
+    std::vector<double> deposit_split = read_tally(path / "filter_deposit_split.csv");
+    std::vector<double> counts = read_tally(path / "filter_counts.csv");
+    std::vector<double> counts_split = read_tally(path / "filter_counts_split.csv");
+
+    // x, y, z, the bin of each filter and the data
+    REQUIRE(deposit.size() == cells * 4);
+    REQUIRE(deposit_split.size() == 6 * cells * 6);
+    REQUIRE(counts.size() == cells * 8);
+    REQUIRE(counts_split.size() == 2 * cells * 9);
+
+    // the energy deposited by the generations 0 to 2 is split into the bins
+    std::vector<double> reference(cells, 0.0);
+    for (const auto &step : steps) {
+        if (step.generation == 3) {
+            continue;
+        }
+        vec3 cell = (step.end / (10.0 / res)).array().floor();
+        if ((cell.array() >= 0.0).all() && (cell.array() < res).all()) {
+            reference[(cell.z() * res + cell.y()) * res + cell.x()] += step.energy - step.end_energy;
+        }
+    }
+
+    for (std::size_t c = 0; c < cells; ++c) {
+        double sum = 0.0;
+        for (std::size_t f = 0; f < 6; ++f) {
+            const double *row = &deposit_split[(f * cells + c) * 6];
+            REQUIRE(row[3] == f / 2);
+            REQUIRE(row[4] == f % 2);
+            sum += row[5];
+        }
+        REQUIRE(std::abs(sum - reference[c]) <= 1e-9 * reference[c]);
+        REQUIRE(deposit[c * 4 + 3] >= sum);
+    }
+
+    // counts of the coherent and the incoherent and photoelectric bins
+    for (std::size_t c = 0; c < cells; ++c) {
+        REQUIRE(counts_split[c * 9 + 4] == counts[c * 8 + 4]);
+        REQUIRE(counts_split[(cells + c) * 9 + 4] == counts[c * 8 + 5] + counts[c * 8 + 6]);
+    }
+}
+
+TEST_CASE("Mesh tally scoring", "[.benchmark]") {
+
+    using projector::tally_score;
+
+    std::vector<projector::particle_step> steps = random_steps(100000);
+
+    for (auto [score, name] : {std::pair{tally_score::flux, "flux"},
+                               {tally_score::average_energy, "average energy"},
+                               {tally_score::interaction_counts, "interaction counts"},
+                               {tally_score::deposited_energy, "deposited energy"}}) {
+
+        projector::uniform_mesh_tally tally("benchmark", {0.0, 0.0, 0.0}, {10.0, 10.0, 10.0},
+                                            {120, 120, 120}, score);
+        tally.init_tally();
+
+        BENCHMARK(std::string(name) + ", 120^3 mesh") {
+            for (const auto &step : steps) {
+                tally.score_step(step);
+            }
+            return steps.size();
+        };
+    }
+
+    // all scores on the same mesh, the scorer traverses each step once for all of them
+    std::vector<std::unique_ptr<projector::tally>> tallies;
+    for (auto score : {tally_score::flux, tally_score::average_energy,
+                       tally_score::interaction_counts, tally_score::deposited_energy}) {
+        tallies.push_back(std::make_unique<projector::uniform_mesh_tally>(
+            "benchmark", vec3(0.0, 0.0, 0.0), vec3(10.0, 10.0, 10.0),
+            projector::coord3(120, 120, 120), score));
+        tallies.back()->init_tally();
+    }
+
+    projector::tally_scorer scorer(tallies);
+
+    BENCHMARK("all scores separately, 120^3 mesh") {
+        for (const auto &step : steps) {
+            for (auto &tally : tallies) {
+                tally->score_step(step);
+            }
+        }
+        return steps.size();
+    };
+
+    BENCHMARK("all scores fused, 120^3 mesh") {
+        for (const auto &step : steps) {
+            scorer.score_step(step);
+        }
+        return steps.size();
+    };
+}